@@ -0,0 +1,154 @@
+//  Bot-vs-fake throughput and reply latency: runs Bot::Run against a
+//  FakeServer serving a synthetic LoadScenario until the final "/stop".
+//
+//  usage: bench_e2e [batches] [batch_size] [mix]
+//
+//  mix is "text=weight,text=weight,..."; without it every predefined mix
+//  is run. Prints one JSON object per mix. Reply latency runs from a
+//  getUpdates batch being served to the matching send* request arriving.
+//  BENCH_GZIP=1 makes the fake gzip its replies; getupdates_bytes_out
+//  shows the bytes that went over the wire.
+
+#include "../telegram/bot.h"
+#include "../telegram/fake.h"
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Mix = std::vector<std::pair<std::string, double>>;
+
+constexpr auto kBotToken = "123";
+constexpr auto kBotFirstName = "Test Bot";
+
+const std::vector<std::pair<std::string, Mix>> kMixes = {
+        {"constant", {{"/weather", 1}, {"/styleguide", 1}, {"/sticker", 1}, {"/gif", 1}}},
+        {"random", {{"/random", 1}}},
+        {"echo", {{"Hello", 1}}},
+        {"mixed", {{"/random", 1}, {"/weather", 1}, {"/styleguide", 1},
+                   {"/sticker", 1}, {"/gif", 1}, {"Hello", 1}}}
+};
+
+Mix ParseMix(const std::string& spec) {
+    Mix mix;
+    std::istringstream items(spec);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        auto pos = item.rfind('=');
+        if (pos == std::string::npos) {
+            mix.emplace_back(item, 1.0);
+        } else {
+            mix.emplace_back(item.substr(0, pos), std::stod(item.substr(pos + 1)));
+        }
+    }
+
+    return mix;
+}
+
+int64_t CpuMicroseconds(int who) {
+    rusage usage{};
+    getrusage(who, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000LL +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+void Bench(
+        const std::string& name,
+        const Mix& mix,
+        size_t batches,
+        size_t batch_size,
+        bool gzip
+) {
+    telegram::LoadScenario scenario;
+    scenario.Batches = batches;
+    scenario.BatchSize = batch_size;
+    scenario.Mix = mix;
+
+    telegram::FakeServerParams params;
+    params.Compression = gzip;
+
+    telegram::FakeServer fake(scenario);
+    fake.SetParams(params);
+    fake.Start();
+
+    //  The fake's update offset must not end up where a real bot runs
+    char state_dir[] = "/tmp/bench_e2e_XXXXXX";
+    if (!mkdtemp(state_dir)) {
+        throw std::runtime_error("Failed to create a state directory");
+    }
+
+    Bot bot(kBotToken, kBotFirstName, "error", fake.GetUrl());
+    bot.SetStateDir(state_dir);
+
+    //  Bot::Run runs on this thread, the fake on its own pool
+    auto bot_cpu_before = CpuMicroseconds(RUSAGE_THREAD);
+    auto process_cpu_before = CpuMicroseconds(RUSAGE_SELF);
+    auto start = Clock::now();
+
+    bot.Run();
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    auto bot_cpu = CpuMicroseconds(RUSAGE_THREAD) - bot_cpu_before;
+    auto process_cpu = CpuMicroseconds(RUSAGE_SELF) - process_cpu_before;
+
+    auto result = fake.GetLoadResult();
+    auto bytes_out = fake.GetStats().BytesOut["getUpdates"];
+    fake.StopAndCheckExpectations();
+    std::filesystem::remove_all(state_dir);
+
+    double updates = std::max<double>(1.0, result.UpdatesServed);
+    const auto& latency = result.ReplyLatency;
+
+    std::cout << "{\"bench\":\"e2e\""
+              << ",\"mix\":\"" << name << "\""
+              << ",\"batches\":" << batches
+              << ",\"batch_size\":" << batch_size
+              << ",\"gzip\":" << (gzip ? "true" : "false")
+              << ",\"updates\":" << result.UpdatesServed
+              << ",\"replies\":" << result.Replies
+              << ",\"seconds\":" << seconds
+              << ",\"updates_per_s\":" << result.UpdatesServed / seconds
+              << ",\"reply_p50_us\":" << latency.Percentile(50)
+              << ",\"reply_p99_us\":" << latency.Percentile(99)
+              << ",\"reply_p999_us\":" << latency.Percentile(99.9)
+              << ",\"reply_max_us\":" << latency.Max()
+              << ",\"bot_cpu_us_per_update\":" << bot_cpu / updates
+              << ",\"process_cpu_us_per_update\":" << process_cpu / updates
+              << ",\"getupdates_bytes_out\":" << bytes_out
+              << "}" << std::endl;
+}
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+    size_t batches = argc > 1 ? std::atoi(argv[1]) : 50;
+    size_t batch_size = argc > 2 ? std::atoi(argv[2]) : 100;
+    const char* gzip_env = std::getenv("BENCH_GZIP");
+    bool gzip = gzip_env && std::string(gzip_env) == "1";
+
+    if (argc > 3) {
+        Bench(argv[3], ParseMix(argv[3]), batches, batch_size, gzip);
+        return 0;
+    }
+
+    for (const auto& [name, mix] : kMixes) {
+        Bench(name, mix, batches, batch_size, gzip);
+    }
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+//  getUpdates parsing throughput: body read + JSON parse + ConvertJsonToUpdates
+//  through TelegramBotAPI::ParseUpdates, without network.
+//
+//  usage: bench_parse [repetitions] [min_time_ms] [log_level]
+//
+//  Prints one JSON object per dataset. Rates are medians
+//  over repetitions, allocation counts are per parsed update.
+//
+//  The logger level is fixed per process. Compare runs at "information"
+//  and at "error" to see what the logging calls on the parse path cost
+//  when their level is disabled; "debug" also prints every response.
+
+#include "../telegram/bot_api.h"
+#include "../telegram/fake_data.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+namespace {
+
+std::atomic<int64_t> allocations{0};
+std::atomic<int64_t> allocated_bytes{0};
+
+}  // namespace
+
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Dataset {
+    std::string name;
+    std::string payload;
+};
+
+struct Result {
+    int64_t iterations;
+    size_t updates;
+    double seconds;
+    int64_t allocations;
+    int64_t allocated_bytes;
+};
+
+double Median(std::vector<double> values) {
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+Result RunOnce(
+        TelegramBotAPI& api,
+        std::istringstream& stream,
+        std::chrono::milliseconds min_time
+) {
+    Result result{0, 0, 0.0, 0, 0};
+
+    auto allocations_before = allocations.load();
+    auto allocated_bytes_before = allocated_bytes.load();
+    auto start = Clock::now();
+    auto deadline = start + min_time;
+
+    do {
+        stream.clear();
+        stream.seekg(0);
+        result.updates += api.ParseUpdates(stream).size();
+        ++result.iterations;
+    } while (Clock::now() < deadline);
+
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    result.allocations = allocations.load() - allocations_before;
+    result.allocated_bytes = allocated_bytes.load() - allocated_bytes_before;
+    return result;
+}
+
+void Bench(
+        TelegramBotAPI& api,
+        const std::string& log_level,
+        const Dataset& dataset,
+        int repetitions,
+        std::chrono::milliseconds min_time
+) {
+    std::istringstream stream(dataset.payload);
+
+    //  Warm-up
+    RunOnce(api, stream, min_time / 4);
+
+    std::vector<double> mb_per_s;
+    std::vector<double> updates_per_s;
+    int64_t total_updates = 0;
+    int64_t total_iterations = 0;
+    int64_t total_allocations = 0;
+    int64_t total_allocated_bytes = 0;
+
+    for (int i = 0; i < repetitions; ++i) {
+        auto result = RunOnce(api, stream, min_time);
+        double bytes = static_cast<double>(dataset.payload.size()) * result.iterations;
+        mb_per_s.push_back(bytes / result.seconds / 1e6);
+        updates_per_s.push_back(result.updates / result.seconds);
+
+        total_updates += result.updates;
+        total_iterations += result.iterations;
+        total_allocations += result.allocations;
+        total_allocated_bytes += result.allocated_bytes;
+    }
+
+    double per_update = total_updates == 0 ? 0.0 : 1.0 / total_updates;
+    double per_iteration = 1.0 / total_iterations;
+
+    std::cout << "{\"bench\":\"parse\""
+              << ",\"dataset\":\"" << dataset.name << "\""
+              << ",\"log_level\":\"" << log_level << "\""
+              << ",\"bytes\":" << dataset.payload.size()
+              << ",\"updates\":" << total_updates / total_iterations
+              << ",\"repetitions\":" << repetitions
+              << ",\"iterations\":" << total_iterations
+              << ",\"mb_per_s\":" << Median(mb_per_s)
+              << ",\"updates_per_s\":" << Median(updates_per_s)
+              << ",\"allocs_per_update\":" << total_allocations * per_update
+              << ",\"alloc_bytes_per_update\":" << total_allocated_bytes * per_update
+              << ",\"allocs_per_response\":" << total_allocations * per_iteration
+              << "}" << std::endl;
+}
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+    int repetitions = argc > 1 ? std::atoi(argv[1]) : 7;
+    std::chrono::milliseconds min_time(argc > 2 ? std::atoi(argv[2]) : 300);
+    //  Production bots run at "information"
+    std::string log_level = argc > 3 ? argv[3] : "information";
+
+    std::vector<Dataset> datasets = {
+            {"zero_messages", FakeData::GetUpdatesZeroMessages},
+            {"one_message", FakeData::GetupdatesOneMessage},
+            {"two_messages", FakeData::GetUpdatesTwoMessages},
+            {"four_messages", FakeData::GetUpdatesFourMessagesJson},
+            {"synthetic_100", FakeData::GenerateUpdatesJson(100)},
+            {"synthetic_1000", FakeData::GenerateUpdatesJson(1000)},
+            {"synthetic_10000", FakeData::GenerateUpdatesJson(10000)}
+    };
+
+    TelegramBotAPI api("123", "bench", log_level, kDefaultTelegramServerUrl);
+    for (const auto& dataset : datasets) {
+        Bench(api, log_level, dataset, repetitions, min_time);
+    }
+
+    return 0;
+}
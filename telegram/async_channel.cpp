@@ -0,0 +1,413 @@
+#include "async_channel.h"
+#include "json_writer.h"
+
+#include <Poco/Exception.h>
+
+#include <cstring>
+#include <ctime>
+#include <utility>
+
+
+namespace {
+
+constexpr size_t kWriteBatchBytes = 1 << 20;
+
+const char* const kPriorityNames[] = {
+        "",
+        "Fatal",
+        "Critical",
+        "Error",
+        "Warning",
+        "Notice",
+        "Information",
+        "Debug",
+        "Trace"
+};
+
+uint64_t
+NextChannelId() {
+    static std::atomic<uint64_t> next{1};
+    return next.fetch_add(1, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+
+struct AsyncChannel::Record {
+    int64_t time;   //  epoch microseconds
+    Poco::Message::Priority priority;
+    long thread_id;
+    std::string source;
+    std::string text;
+};
+
+
+//  Single-producer single-consumer ring: the owning thread pushes,
+//  the writer thread pops.
+class AsyncChannel::Ring {
+public:
+    explicit Ring(size_t capacity): records_(capacity) {}
+
+    Record* Reserve() {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == records_.size()) {
+            return nullptr;
+        }
+
+        return &records_[tail % records_.size()];
+    }
+
+    void Publish() {
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    Record* Front() {
+        auto head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        return &records_[head % records_.size()];
+    }
+
+    void Pop() {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    size_t Size() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+    size_t Capacity() const { return records_.size(); }
+
+    //  Producer only
+    size_t sampled = 0;
+
+private:
+    std::vector<Record> records_;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+
+AsyncChannel::
+AsyncChannel(
+        Options options
+):
+        options_{std::move(options)},
+        id_{NextChannelId()}
+{}
+
+AsyncChannel::
+~AsyncChannel() {
+    close();
+}
+
+void
+AsyncChannel::
+open() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (writer_.joinable()) {
+        return;
+    }
+
+    OpenFile();
+    stop_requested_ = false;
+    writer_stopped_ = false;
+    running_.store(true);
+    writer_ = std::thread(&AsyncChannel::WriterLoop, this);
+}
+
+void
+AsyncChannel::
+close() {
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (!writer_.joinable()) {
+            return;
+        }
+
+        running_.store(false);
+    }
+
+    //  A log() that saw the channel running publishes before the writer
+    //  stops; later ones count their message as dropped
+    while (logging_.load() != 0) {
+        std::this_thread::yield();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        stop_requested_ = true;
+    }
+    wake_cv_.notify_one();
+    writer_.join();
+
+    if (file_) {
+        fclose(file_);
+        file_ = nullptr;
+    }
+}
+
+void
+AsyncChannel::
+log(
+        const Poco::Message& message
+) {
+    logging_.fetch_add(1);
+    if (running_.load()) {
+        Enqueue(message);
+    } else {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    logging_.fetch_sub(1);
+
+    if (message.getPriority() <= Poco::Message::PRIO_ERROR) {
+        Flush();
+    }
+}
+
+void
+AsyncChannel::
+Flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (writer_stopped_) {
+        return;
+    }
+
+    auto target = ++flush_requested_;
+    wake_cv_.notify_one();
+    flushed_cv_.wait(lock, [this, target] {
+        return flushed_ >= target || writer_stopped_;
+    });
+}
+
+void
+AsyncChannel::
+Enqueue(
+        const Poco::Message& message
+) {
+    auto& ring = ThreadRing();
+    Record* record = ring.Reserve();
+
+    if (record && options_.overload == OverloadPolicy::Sample &&
+            ring.Size() > ring.Capacity() / 2 &&
+            ring.sampled++ % options_.sample_rate != 0) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    while (!record) {
+        if (options_.overload != OverloadPolicy::Block ||
+                !running_.load(std::memory_order_acquire)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        wake_requested_ = true;
+        wake_cv_.notify_one();
+        std::this_thread::yield();
+        record = ring.Reserve();
+    }
+
+    record->time = message.getTime().epochMicroseconds();
+    record->priority = message.getPriority();
+    record->thread_id = message.getTid();
+    record->source.assign(message.getSource());
+    record->text.assign(message.getText());
+    ring.Publish();
+
+    //  Do not wait for the flush interval when the ring fills up
+    if (ring.Size() == ring.Capacity() / 2) {
+        wake_requested_ = true;
+        wake_cv_.notify_one();
+    }
+}
+
+AsyncChannel::Ring&
+AsyncChannel::
+ThreadRing() {
+    thread_local std::vector<std::pair<uint64_t, std::shared_ptr<Ring>>> thread_rings;
+    for (const auto& [id, ring] : thread_rings) {
+        if (id == id_) {
+            return *ring;
+        }
+    }
+
+    auto ring = std::make_shared<Ring>(options_.ring_capacity);
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        rings_.push_back(ring);
+    }
+
+    thread_rings.emplace_back(id_, ring);
+    return *ring;
+}
+
+void
+AsyncChannel::
+WriterLoop() {
+    std::vector<std::shared_ptr<Ring>> rings;
+    while (true) {
+        bool stopping;
+        uint64_t flush;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_cv_.wait_for(lock, options_.flush_interval, [this] {
+                return stop_requested_ || wake_requested_ || flush_requested_ != flushed_;
+            });
+
+            wake_requested_ = false;
+            stopping = stop_requested_;
+            flush = flush_requested_;
+            rings = rings_;
+        }
+
+        for (const auto& ring : rings) {
+            Drain(*ring);
+        }
+
+        auto dropped = dropped_.load(std::memory_order_relaxed);
+        if (dropped != reported_dropped_) {
+            Record record{
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::system_clock::now().time_since_epoch()).count(),
+                    Poco::Message::PRIO_WARNING,
+                    0,
+                    "AsyncChannel",
+                    std::to_string(dropped - reported_dropped_) + " log messages dropped"};
+            Format(record);
+            reported_dropped_ = dropped;
+        }
+
+        WriteBuffer();
+        {
+            std::lock_guard<std::mutex> guard(mutex_);
+            flushed_ = flush;
+            writer_stopped_ = stopping;
+        }
+        flushed_cv_.notify_all();
+
+        if (stopping) {
+            return;
+        }
+    }
+}
+
+void
+AsyncChannel::
+Drain(
+        Ring& ring
+) {
+    while (Record* record = ring.Front()) {
+        Format(*record);
+        ring.Pop();
+
+        if (buffer_.size() >= kWriteBatchBytes) {
+            WriteBuffer();
+        }
+    }
+}
+
+void
+AsyncChannel::
+Format(
+        const Record& record
+) {
+    const char* priority = kPriorityNames[record.priority];
+
+    if (options_.structured) {
+        buffer_ += R"({"ts_us":)";
+        buffer_ += std::to_string(record.time);
+        buffer_ += R"(,"level":")";
+        buffer_ += priority;
+        buffer_ += R"(","tid":)";
+        buffer_ += std::to_string(record.thread_id);
+        buffer_ += R"(,"source":)";
+        AppendJsonString(buffer_, record.source);
+        buffer_ += R"(,"text":)";
+        AppendJsonString(buffer_, record.text);
+        buffer_ += "}\n";
+        return;
+    }
+
+    //  "%Y-%m-%d %H:%M:%S.%F %s: %p: %t"
+    std::time_t seconds = record.time / 1000000;
+    std::tm time{};
+    gmtime_r(&seconds, &time);
+
+    char timestamp[32];
+    auto length = std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &time);
+    snprintf(timestamp + length, sizeof(timestamp) - length, ".%06d ",
+             static_cast<int>(record.time % 1000000));
+
+    buffer_ += timestamp;
+    buffer_ += record.source;
+    buffer_ += ": ";
+    buffer_ += priority;
+    buffer_ += ": ";
+    buffer_ += record.text;
+    buffer_ += '\n';
+}
+
+void
+AsyncChannel::
+WriteBuffer() {
+    if (buffer_.empty()) {
+        return;
+    }
+
+    FILE* out = file_ ? file_ : stderr;
+    fwrite(buffer_.data(), 1, buffer_.size(), out);
+    fflush(out);
+
+    file_size_ += buffer_.size();
+    buffer_.clear();
+
+    if (file_ && options_.rotate_size > 0 && file_size_ >= options_.rotate_size) {
+        Rotate();
+    }
+}
+
+void
+AsyncChannel::
+OpenFile() {
+    if (options_.path.empty()) {
+        return;
+    }
+
+    file_ = fopen(options_.path.c_str(), "a");
+    if (!file_) {
+        throw Poco::OpenFileException(
+                "Failed to open log file ('" + options_.path + "'). Error: " + strerror(errno));
+    }
+
+    fseek(file_, 0, SEEK_END);
+    file_size_ = ftell(file_);
+}
+
+void
+AsyncChannel::
+Rotate() {
+    fclose(file_);
+    file_ = nullptr;
+
+    const auto& path = options_.path;
+    if (options_.rotate_count == 0) {
+        std::remove(path.c_str());
+    } else {
+        for (size_t i = options_.rotate_count - 1; i > 0; --i) {
+            std::rename((path + "." + std::to_string(i)).c_str(),
+                        (path + "." + std::to_string(i + 1)).c_str());
+        }
+        std::rename(path.c_str(), (path + ".1").c_str());
+    }
+
+    //  Keep logging to stderr rather than lose messages
+    try {
+        OpenFile();
+    } catch (Poco::Exception&) {
+        file_ = nullptr;
+    }
+    file_size_ = 0;
+}
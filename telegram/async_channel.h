@@ -0,0 +1,100 @@
+#ifndef TELEGRAM_ASYNC_CHANNEL_H
+#define TELEGRAM_ASYNC_CHANNEL_H
+
+
+#include <Poco/Channel.h>
+#include <Poco/Message.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+//  Poco channel that never does I/O on the logging thread. Every thread
+//  gets its own single-producer ring of records, a background writer
+//  drains all rings in batches into a file (or stderr) and rotates the
+//  file by size. Records keep their string capacity between uses, so
+//  logging does not allocate once the ring has warmed up. Lines are
+//  ordered per thread, not globally. Errors and worse are written before
+//  log() returns, since a crash often follows them.
+class AsyncChannel : public Poco::Channel {
+public:
+    //  What a thread does when its ring is full
+    enum class OverloadPolicy {
+        Drop,       //  drop the message
+        Block,      //  wait for the writer
+        Sample      //  above half capacity keep every sample_rate-th
+                    //  message, drop the rest; drop when full
+    };
+
+    struct Options {
+        std::string path;                   //  empty for stderr
+        size_t rotate_size = 64 << 20;      //  0 disables rotation
+        size_t rotate_count = 5;            //  path.1 .. path.N are kept
+        size_t ring_capacity = 4096;        //  records per thread
+        OverloadPolicy overload = OverloadPolicy::Drop;
+        size_t sample_rate = 16;
+        bool structured = false;            //  JSON lines instead of text
+        std::chrono::milliseconds flush_interval{50};
+    };
+
+    explicit AsyncChannel(Options options);
+
+    void open() override;
+    void close() override;
+    void log(const Poco::Message& message) override;
+
+    //  Waits until everything logged so far is written
+    void Flush();
+
+    int64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+protected:
+    ~AsyncChannel() override;
+
+private:
+    struct Record;
+    class Ring;
+
+    void Enqueue(const Poco::Message& message);
+    Ring& ThreadRing();
+    void WriterLoop();
+    void Drain(Ring& ring);
+    void Format(const Record& record);
+    void WriteBuffer();
+    void OpenFile();
+    void Rotate();
+
+    const Options options_;
+    const uint64_t id_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_cv_;
+    std::condition_variable flushed_cv_;
+    bool stop_requested_ = false;
+    bool writer_stopped_ = true;
+    uint64_t flush_requested_ = 0;
+    uint64_t flushed_ = 0;
+    std::atomic<bool> wake_requested_{false};
+    std::vector<std::shared_ptr<Ring>> rings_;
+    std::thread writer_;
+    std::atomic<bool> running_{false};
+    //  log() calls in flight; close() waits for them
+    std::atomic<int32_t> logging_{0};
+    std::atomic<int64_t> dropped_{0};
+
+    //  Writer thread only
+    FILE* file_ = nullptr;
+    size_t file_size_ = 0;
+    std::string buffer_;
+    int64_t reported_dropped_ = 0;
+};
+
+
+#endif //TELEGRAM_ASYNC_CHANNEL_H
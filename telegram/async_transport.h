@@ -0,0 +1,92 @@
+#ifndef TELEGRAM_ASYNC_TRANSPORT_H
+#define TELEGRAM_ASYNC_TRANSPORT_H
+
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+
+struct TransportOptions {
+    //  "http://host:port" or "https://host:port"; the path is ignored
+    std::string server_url;
+
+    //  Kept-alive connections to the server
+    size_t connections = 8;
+    //  Requests sent on a connection before its first response arrives;
+    //  above 1 the server must support HTTP/1.1 pipelining
+    size_t pipeline_depth = 1;
+    //  Submit() blocks while this many requests are queued or in flight
+    size_t max_pending = 100000;
+
+    std::chrono::milliseconds connect_timeout{10000};
+    //  From Submit() to the end of the response, queueing included
+    std::chrono::milliseconds request_timeout{60000};
+
+    bool verify_peer = true;
+};
+
+
+struct TransportRequest {
+    const char* method = "POST";
+    std::string target;
+    std::string content_type = "application/json";
+    std::string body;
+};
+
+
+struct TransportResponse {
+    //  HTTP status, 0 if the request failed before a response arrived
+    int status = 0;
+    int32_t retry_after = 0;
+    std::string body;
+    //  Why the request failed, empty if a response arrived
+    std::string error;
+    //  The request reached the socket, so without a response the server
+    //  may still have processed it. Requests that never did are sent
+    //  again, or fail with this false.
+    bool sent = false;
+    //  Connections the request was handed to; above 1 after a connection
+    //  closed before the request was written
+    int32_t attempts = 0;
+};
+
+
+//  HTTP/1.1 client for many concurrent requests, e.g. bulk send*.
+//  Requests are spread over a pool of kept-alive connections and served
+//  by one event loop thread. Callbacks run on that thread and must not
+//  block; they may Submit() more requests.
+class AsyncTransport {
+public:
+    using Callback = std::function<void(TransportResponse& response)>;
+
+    virtual ~AsyncTransport() = default;
+
+    //  Thread-safe. Every request gets exactly one callback.
+    virtual void Submit(TransportRequest request, Callback callback) = 0;
+
+    //  Blocks until every submitted request has got its callback.
+    //  Must not be called from a callback.
+    virtual void Flush() = 0;
+};
+
+
+enum class TransportBackend {
+    Poco,
+    Epoll,
+    IoUring
+};
+
+//  Linux only. Throws std::runtime_error if the event loop cannot start.
+std::unique_ptr<AsyncTransport> MakeEpollTransport(const TransportOptions& options);
+
+#ifdef TELEGRAM_IO_URING
+//  Linux 5.7+, built with -DTELEGRAM_IO_URING=ON. Throws std::runtime_error
+//  if the kernel refuses io_uring (e.g. disabled by sysctl or seccomp).
+std::unique_ptr<AsyncTransport> MakeIoUringTransport(const TransportOptions& options);
+#endif
+
+
+#endif //TELEGRAM_ASYNC_TRANSPORT_H
@@ -1,9 +1,15 @@
 #include "bot.h"
+#include "logger.h"
+#include "metrics.h"
+#include "tracing.h"
 
 #include <Poco/Net/NetException.h>
 
+#include <algorithm>
 #include <fstream>
+#include <optional>
 #include <random>
+#include <thread>
 
 
 Bot::Bot(
@@ -12,48 +18,278 @@ Bot::Bot(
         const std::string& log_level,
         const std::string& server_url
 ):
-        TelegramBotAPI(token, first_name, log_level, server_url)
+        TelegramBotAPI(token, first_name, log_level, server_url),
+        token_{token},
+        first_name_{first_name},
+        log_level_{log_level},
+        server_url_{server_url}
 {
     update_id_ = 0;
     updates_ = {};
+
+    //  Replies are fire-and-forget
+    SetFastSendResponses(true);
+
+    weather_reply_ = MakeSendMessageTemplate("Winter Is Coming.");
+    styleguide_reply_ = MakeSendMessageTemplate("//  TODO: funny joke");
+    sticker_reply_ = MakeSendStickerTemplate("CAADAgADegADECECEAACxyOkybkFAg");
+    gif_reply_ = MakeSendDocumentTemplate("CgADAgADjQADJ7MRSM0LdfDklYBfAg");
 }
 
 void Bot::Run() {
     LoadUpdateId();
+
+    std::vector<std::string> update_types;
+    for (const auto& handler : kUpdateHandlers) {
+        update_types.push_back(handler.update_type);
+    }
+    SetAllowedUpdates(update_types);
+
     InitSession();
-    CheckBotInfo();
+    StartBotInfoCheck();
+
+    stop_requested_ = false;
+    size_t failures = 0;
+    while (true) {
+        try {
+            PollUpdates(failures);
+
+        } catch (Poco::Net::ConnectionAbortedException& e) {
+            if (!stop_requested_) {
+                Reconnect(e, failures++);
+                continue;
+            }
 
-    try {
-        while (true) {
-            auto updates = GetUpdates(update_id_, kTimeout);
-            for (const auto& upd : updates) {
-                update_id_ = upd.update_id + 1;
-                if (upd.message) {
-                    ProcessMessage(*upd.message);
+            SaveUpdateId();
+            AbortSession();
+            return;
+
+        } catch (Poco::Net::ConnectionResetException& e) {
+            if (!stop_requested_) {
+                Reconnect(e, failures++);
+                continue;
+            }
+
+            SaveUpdateId();
+            CloseSession();
+            return;
+
+        } catch (ApiException& e) {
+            //  Server errors and flood limits pass. Other statuses of
+            //  getUpdates and getMe, e.g. 401 for a revoked token or 409
+            //  for a second poller, do not; replies never get here.
+            if (e.code() != 429 && e.code() < 500) {
+                poco_error(log(), e.displayText());
+                SaveUpdateId();
+                CloseSession();
+                throw;
+            }
+
+            Reconnect(e, failures++, std::chrono::seconds(e.RetryAfter()));
+
+        } catch (Poco::Net::NetException& e) {
+            Reconnect(e, failures++);
+
+        } catch (Poco::TimeoutException& e) {
+            Reconnect(e, failures++);
+
+        } catch (Poco::Exception& e) {
+            poco_error(log(), e.displayText());
+            SaveUpdateId();
+            CloseSession();
+            throw;
+
+        } catch (std::exception& e) {
+            poco_error(log(), e.what());
+            SaveUpdateId();
+            CloseSession();
+            throw;
+        }
+    }
+}
+
+void Bot::PollUpdates(size_t& failures) {
+    auto& queue_depth = GetMetricsRegistry().GetGauge(
+            "telegram_update_queue_depth", {},
+            "Received updates not processed yet");
+
+    while (true) {
+        polling_ = true;
+        auto updates = GetUpdates(update_id_, poll_timeout_);
+        polling_ = false;
+        poll_timeout_ = std::min(poll_timeout_ + 1, max_poll_timeout_);
+        failures = 0;
+
+        //  No replies before the bot is known to be the right one
+        AwaitBotInfoCheck();
+
+        queue_depth.Set(updates.size());
+        for (const auto& upd : updates) {
+            update_id_ = upd.update_id + 1;
+            DispatchUpdate(upd);
+            queue_depth.Add(-1);
+        }
+    }
+}
+
+void Bot::DispatchUpdate(const Update& update) {
+    for (const auto& handler : kUpdateHandlers) {
+        if (const auto& message = update.*handler.field) {
+            ScopedTraceId trace_id(update.update_id);
+            TraceSpan dispatch_span("dispatch");
+            try {
+                (this->*handler.process)(*message);
+
+            } catch (ApiException& e) {
+                //  A chat that blocked the bot or is gone must not stop the
+                //  others; update_id_ is already past this update. Flood
+                //  limits and server errors still reconnect.
+                if (e.code() == 429 || e.code() >= 500) {
+                    throw;
                 }
+
+                poco_warning(log(), "Reply to update " + std::to_string(update.update_id)
+                                    + " failed: " + e.displayText());
             }
         }
+    }
+}
+
+void Bot::Reconnect(const Poco::Exception& error, size_t failures, std::chrono::seconds retry_after) {
+    static auto& reconnects = GetMetricsRegistry().GetCounter(
+            "telegram_reconnects_total", {},
+            "Sessions recreated after network errors");
+
+    auto limit = reconnect_max_delay_;
+    if (failures < 32) {
+        limit = std::min(limit, reconnect_base_delay_ * (int64_t{1} << failures));
+    }
+    std::chrono::milliseconds delay{std::uniform_int_distribution<int64_t>(
+            0, limit.count())(reconnect_random_)};
+    delay = std::max<std::chrono::milliseconds>(delay, retry_after);
+
+    poco_warning(log(), error.displayText() + ". Reconnecting in "
+                        + std::to_string(delay.count()) + " ms");
+    reconnects.Increment();
+
+    if (polling_) {
+        //  The same getUpdates is sent again
+        GetUpdatesRetries().Increment();
+        polling_ = false;
+        poll_timeout_ = std::max(poll_timeout_ / 2, min_poll_timeout_);
+    }
+
+    CloseSession();
+    std::this_thread::sleep_for(delay);
+    InitSession();
+}
+
+void Bot::StartBotInfoCheck() {
+    bot_info_verified_ = LoadBotInfo();
+    if (bot_info_verified_) {
+        poco_information(log(), "Bot info loaded from " + bot_info_path_);
+        return;
+    }
+
+    //  getMe goes over its own session, so it overlaps with the first poll
+    bot_info_check_ = std::async(std::launch::async, [this] {
+        TelegramBotAPI checker(token_, first_name_, log_level_, server_url_);
+        checker.InitSession();
+        return checker.CheckBotInfo();
+    });
+}
+
+void Bot::AwaitBotInfoCheck() {
+    if (bot_info_verified_) {
+        return;
+    }
+
+    std::optional<User> user;
+    if (bot_info_check_.valid()) {
+        try {
+            user = bot_info_check_.get();
+
+        } catch (Poco::LogicException& e) {
+            throw;
+
+        } catch (Poco::Exception& e) {
+            //  Only a mismatch is fatal, the check is redone on this session
+            poco_warning(log(), "Bot info check failed: " + e.displayText());
+        }
+    }
+
+    if (!user) {
+        user = CheckBotInfo();
+    }
+
+    bot_info_verified_ = true;
+    SaveBotInfo(*user);
+}
 
-    } catch (Poco::Net::ConnectionAbortedException& e) {
-        SaveUpdateId();
-        AbortSession();
+bool Bot::LoadBotInfo() {
+    if (bot_info_ttl_.count() == 0) {
+        return false;
+    }
 
-    } catch (Poco::Net::ConnectionResetException& e) {
-        SaveUpdateId();
-        CloseSession();
+    std::ifstream fin(bot_info_path_);
+    int64_t verified_at = 0;
+    std::string bot_id;
+    int32_t user_id = 0;
+    std::string first_name;
+    if (!(fin >> verified_at >> bot_id >> user_id) ||
+            !std::getline(fin >> std::ws, first_name)) {
+        return false;
+    }
 
-    } catch (Poco::Exception& e) {
-        log().error(e.displayText());
-        SaveUpdateId();
-        CloseSession();
-        throw;
+    auto age = std::chrono::system_clock::now() -
+               std::chrono::system_clock::time_point(std::chrono::seconds(verified_at));
+
+    //  The part of the token before ':' is the bot id
+    return age.count() >= 0 && age < bot_info_ttl_ &&
+           bot_id == token_.substr(0, token_.find(':')) &&
+           first_name == first_name_;
+}
 
-    } catch (std::exception& e) {
-        log().error(e.what());
-        SaveUpdateId();
-        CloseSession();
-        throw;
+void Bot::SaveBotInfo(const User& user) {
+    if (bot_info_ttl_.count() == 0) {
+        return;
     }
+
+    std::ofstream fout(bot_info_path_, std::ios_base::trunc);
+    if (!fout.is_open()) {
+        poco_warning(log(), "Failed to open file to save bot info ('" +
+                            bot_info_path_ + "'). Error: " + strerror(errno));
+        return;
+    }
+
+    auto now = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch());
+    fout << now.count() << ' ' << token_.substr(0, token_.find(':')) << ' '
+         << user.id << ' ' << user.first_name << '\n';
+}
+
+void Bot::SetBotInfoCacheTtl(std::chrono::seconds ttl) {
+    bot_info_ttl_ = ttl;
+}
+
+void Bot::SetPollTimeout(int32_t min_timeout, int32_t max_timeout) {
+    min_poll_timeout_ = min_timeout;
+    max_poll_timeout_ = max_timeout;
+    poll_timeout_ = max_timeout;
+}
+
+void Bot::SetStateDir(const std::string& dir) {
+    auto prefix = dir.empty() || dir.back() == '/' ? dir : dir + "/";
+    update_id_path_ = prefix + kUpdateIdFilename;
+    bot_info_path_ = prefix + kBotInfoFilename;
+}
+
+void Bot::SetReconnectBackoff(
+        std::chrono::milliseconds base_delay,
+        std::chrono::milliseconds max_delay
+) {
+    reconnect_base_delay_ = base_delay;
+    reconnect_max_delay_ = max_delay;
 }
 
 void Bot::ProcessMessage(const Message& message) {
@@ -73,6 +309,7 @@ void Bot::ProcessTextMessage(const Message& message) {
         //  into default case in switch below
     }
 
+    TraceSpan handler_span(kTextCommandSpans[static_cast<size_t>(cmd)]);
     switch (cmd) {
 
         case TextCommands::Random:
@@ -111,27 +348,29 @@ void Bot::ProcessRandom(const Message& message) {
 }
 
 void Bot::ProcessWeather(const Message& message) {
-    SendMessage(message.chat.id, "Winter Is Coming.");
+    Send(weather_reply_, message.chat.id);
 }
 
 void Bot::ProcessStyleguide(const Message& message) {
-    SendMessage(message.chat.id, "//  TODO: funny joke");
+    Send(styleguide_reply_, message.chat.id);
 }
 
 void Bot::ProcessStop(const Message& message) {
+    stop_requested_ = true;
     throw Poco::Net::ConnectionResetException("'/stop' command received");
 }
 
 void Bot::ProcessCrash(const Message& message) {
+    stop_requested_ = true;
     throw Poco::Net::ConnectionAbortedException("'/crash' command received");
 }
 
 void Bot::ProcessSticker(const Message& message) {
-    SendSticker(message.chat.id, "CAADAgADegADECECEAACxyOkybkFAg");
+    Send(sticker_reply_, message.chat.id);
 }
 
 void Bot::ProcessGif(const Message& message) {
-    SendDocument(message.chat.id, "CgADAgADjQADJ7MRSM0LdfDklYBfAg");
+    Send(gif_reply_, message.chat.id);
 }
 
 void Bot::ProcessDefault(const Message& message) {
@@ -139,11 +378,11 @@ void Bot::ProcessDefault(const Message& message) {
 }
 
 void Bot::SaveUpdateId() {
-    std::ofstream fout(kUpdateIdFilename, std::ios_base::trunc);
+    std::ofstream fout(update_id_path_, std::ios_base::trunc);
     if (!fout.is_open()) {
         throw Poco::OpenFileException(
                 "Failed to open file to save update id ('" +
-                kUpdateIdFilename + "'). Error: " + strerror(errno));
+                update_id_path_ + "'). Error: " + strerror(errno));
     }
 
     fout << std::to_string(update_id_);
@@ -151,7 +390,7 @@ void Bot::SaveUpdateId() {
 }
 
 void Bot::LoadUpdateId() {
-    std::ifstream fin(kUpdateIdFilename);
+    std::ifstream fin(update_id_path_);
     if (!fin.is_open()) {
         if (errno == ENOENT) {  //  No such file
             update_id_ = 0;
@@ -160,7 +399,7 @@ void Bot::LoadUpdateId() {
 
         throw Poco::OpenFileException(
                 "Failed to open file to load update id ('" +
-                kUpdateIdFilename + "'). Error: " + strerror(errno));
+                update_id_path_ + "'). Error: " + strerror(errno));
     }
 
     fin >> update_id_;
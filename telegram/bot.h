@@ -1,10 +1,15 @@
 #ifndef TELEGRAM_BOT_H
 #define TELEGRAM_BOT_H
 
+#include <chrono>
+#include <future>
 #include <queue>
+#include <random>
 #include <unordered_map>
 #include "bot_api.h"
 
+#include <Poco/Exception.h>
+
 
 class Bot : public TelegramBotAPI {
 public:
@@ -14,7 +19,33 @@ public:
         const std::string& log_level = "debug",
         const std::string& server_url = kDefaultTelegramServerUrl);
 
+    //  Polls and dispatches updates until '/stop' or '/crash'. Network
+    //  errors, 5xx and 429 recreate the session after a jittered
+    //  exponential backoff and polling resumes from the in-memory offset.
+    //  Other error statuses of getUpdates and getMe are rethrown as
+    //  ApiException; those of replies are logged and the update skipped.
     void Run();
+    void SetReconnectBackoff(
+            std::chrono::milliseconds base_delay,
+            std::chrono::milliseconds max_delay);
+
+    //  Bot info verified by getMe is cached on disk for `ttl`, and Run
+    //  skips the check while it is fresh. Otherwise the check runs on
+    //  its own session alongside the first getUpdates. Zero disables
+    //  the cache.
+    void SetBotInfoCacheTtl(std::chrono::seconds ttl);
+
+    //  Long-poll timeout bounds, in seconds. The timeout starts at max,
+    //  is halved after a failed poll and grows by a second after each
+    //  successful one, so it settles below whatever idle limit the
+    //  network path enforces.
+    void SetPollTimeout(int32_t min_timeout, int32_t max_timeout);
+
+    //  Directory of the update offset and bot info files, the current
+    //  one by default. Benchmarks and tests must not share it with the
+    //  real bot, which would resume from their offset.
+    void SetStateDir(const std::string& dir);
+
     void ProcessMessage(const Message& message);
     void ProcessTextMessage(const Message& message);
     void ProcessRandom(const Message& message);
@@ -35,7 +66,27 @@ public:
     void LoadUpdateId();
 
 private:
+    void PollUpdates(size_t& failures);
+    void DispatchUpdate(const Update& update);
+    void StartBotInfoCheck();
+    void AwaitBotInfoCheck();
+    bool LoadBotInfo();
+    void SaveBotInfo(const User& user);
+    //  Waits at least `retry_after`, as a flood limit asks
+    void Reconnect(
+            const Poco::Exception& error,
+            size_t failures,
+            std::chrono::seconds retry_after = std::chrono::seconds(0));
+
     const std::string kUpdateIdFilename = "blablabot_update_id.txt";
+    const std::string kBotInfoFilename = "blablabot_bot_info.txt";
+    std::string update_id_path_ = kUpdateIdFilename;
+    std::string bot_info_path_ = kBotInfoFilename;
+
+    std::string token_;
+    std::string first_name_;
+    std::string log_level_;
+    std::string server_url_;
 
     enum class TextCommands {
         Random,
@@ -58,8 +109,55 @@ private:
             {"/gif", TextCommands::Gif}
     };
 
-    int32_t kTimeout = 30;
+    //  Handlers by update type. getUpdates asks only for the types
+    //  listed here, the server drops the rest.
+    struct UpdateHandler {
+        const char* update_type;
+        std::unique_ptr<Message> Update::* field;
+        void (Bot::* process)(const Message&);
+    };
+
+    static constexpr UpdateHandler kUpdateHandlers[] = {
+            {"message", &Update::message, &Bot::ProcessMessage}
+    };
+
+    //  Trace span names of handlers, indexed by TextCommands
+    static constexpr const char* kTextCommandSpans[] = {
+            "handle_random",
+            "handle_weather",
+            "handle_styleguide",
+            "handle_stop",
+            "handle_crash",
+            "handle_sticker",
+            "handle_gif",
+            "handle_default"
+    };
+
+    //  Constant replies, encoded once
+    SendTemplate weather_reply_;
+    SendTemplate styleguide_reply_;
+    SendTemplate sticker_reply_;
+    SendTemplate gif_reply_;
+
+    int32_t min_poll_timeout_ = 1;
+    int32_t max_poll_timeout_ = 30;
+    int32_t poll_timeout_ = max_poll_timeout_;
+    bool polling_ = false;
+
     int32_t update_id_;
+
+    //  Set by '/stop' and '/crash', which unwind Run with the same
+    //  exceptions as real network errors
+    bool stop_requested_ = false;
+
+    //  Reconnect delay is uniform in [0, min(max, base * 2^failures)]
+    std::chrono::milliseconds reconnect_base_delay_{100};
+    std::chrono::milliseconds reconnect_max_delay_{30000};
+    std::mt19937 reconnect_random_{std::random_device{}()};
+
+    std::chrono::seconds bot_info_ttl_{24 * 60 * 60};
+    bool bot_info_verified_ = false;
+    std::future<User> bot_info_check_;
     std::queue<Update> updates_;
 };
 
@@ -1,17 +1,33 @@
 #include "bot_api.h"
+#include "json_writer.h"
 #include "logger.h"
+#include "metrics.h"
+#include "request_path.h"
+#include "tracing.h"
 
+#include <Poco/InflatingStream.h>
 #include <Poco/Net/Context.h>
 #include <Poco/Net/HTTPSClientSession.h>
 #include <Poco/Net/HTTPMessage.h>
 #include <Poco/Net/HTTPRequest.h>
 #include <Poco/Net/HTTPResponse.h>
 #include <Poco/Net/NetException.h>
+#include <Poco/Net/SecureStreamSocket.h>
+#include <Poco/StreamCopier.h>
 #include <Poco/URI.h>
 #include <jsoncpp/json/json.h>
 
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <mutex>
 #include <optional>
+#include <random>
+#include <typeinfo>
 #include <unordered_map>
 
 using Poco::Logger;
@@ -25,6 +41,134 @@ using Poco::Net::HTTPSClientSession;
 using Poco::URI;
 
 
+namespace {
+
+//  Bytes of an uploaded file held in memory at a time
+constexpr size_t kUploadChunkSize = 64 * 1024;
+
+//  One context for all sessions, so that reconnects resume TLS sessions
+//  from its cache instead of doing full handshakes
+Context::Ptr
+SharedTlsContext() {
+    static Context::Ptr context = [] {
+        Context::Ptr tls_context = new Context(
+                Context::CLIENT_USE, "", Context::VERIFY_RELAXED, 9, true);
+        tls_context->enableSessionCache(true);
+        return tls_context;
+    }();
+
+    return context;
+}
+
+//  Poco connects lazily on the first request, this makes it possible
+//  to connect ahead of time
+template <class Session>
+class ConnectableSession : public Session {
+public:
+    using Session::Session;
+
+    void Connect() {
+        this->reconnect();
+    }
+};
+
+
+//  Fills the outcome of a send* response. Only bodies other than a plain
+//  {"ok":true are parsed; this runs on transport threads, hence the
+//  thread-local reader.
+void
+ReadSendResult(
+        int status,
+        const std::string& body,
+        SendResult& result
+) {
+    result.status = status;
+    if (status == 200 && HasOkTruePrefix(body)) {
+        result.ok = true;
+        return;
+    }
+
+    thread_local std::unique_ptr<Json::CharReader> reader{Json::CharReaderBuilder().newCharReader()};
+    Json::Value json;
+    std::string errs;
+    if (!reader->parse(body.data(), body.data() + body.size(), &json, &errs) || !json.isObject()) {
+        result.description = "Invalid response body: " + body.substr(0, 200);
+        return;
+    }
+
+    result.ok = status == 200 && json["ok"].isBool() && json["ok"].asBool();
+    if (json["error_code"].isInt()) {
+        result.error_code = json["error_code"].asInt();
+    }
+    if (json["description"].isString()) {
+        result.description = json["description"].asString();
+    }
+
+    const auto& parameters = json["parameters"];
+    if (parameters.isObject()) {
+        if (parameters["retry_after"].isInt()) {
+            result.retry_after = parameters["retry_after"].asInt();
+        }
+        if (parameters["migrate_to_chat_id"].isInt64()) {
+            result.migrate_to_chat_id = parameters["migrate_to_chat_id"].asInt64();
+        }
+    }
+}
+
+}  // namespace
+
+
+ApiException::ApiException(const std::string& msg, int status, int32_t retry_after):
+        Poco::Net::HTTPException{msg, status},
+        retry_after_{retry_after}
+{}
+
+const char* ApiException::name() const noexcept {
+    return "Bot API error";
+}
+
+const char* ApiException::className() const noexcept {
+    return typeid(*this).name();
+}
+
+Poco::Exception* ApiException::clone() const {
+    return new ApiException(*this);
+}
+
+void ApiException::rethrow() const {
+    throw *this;
+}
+
+
+struct SendTemplate::Encoded {
+    Encoded(ApiMethodMetrics& metrics, const std::string& path):
+            metrics{metrics},
+            request{HTTPRequest::HTTP_POST, path, HTTPMessage::HTTP_1_1}
+    {
+        request.setContentType("application/json");
+    }
+
+    ApiMethodMetrics& metrics;
+    std::string body_prefix;    //  up to the chat_id value
+    std::string body_suffix;    //  after the chat_id value
+
+    //  Reused by every send, only Content-Length changes
+    mutable HTTPRequest request;
+
+    void FormatBody(int64_t chat_id, std::string& body) const {
+        char digits[24];
+        auto chat_id_end = std::to_chars(digits, digits + sizeof(digits), chat_id).ptr;
+        body.assign(body_prefix).append(digits, chat_id_end).append(body_suffix);
+    }
+};
+
+Counter&
+SendTemplate
+::retries() const {
+    return encoded_->metrics.retries;
+}
+
+
 class TelegramBotAPI::TelegramBotAPIImpl {
 public:
     TelegramBotAPIImpl(
@@ -36,14 +180,38 @@ public:
             token_{std::move(token)},
             first_name_{std::move(first_name)},
             server_url_{server_url},
-            log_{GetLogger("BotLog", kLogLevels.at(log_level))}
-    {}
+            paths_{URI(server_url).getPath(), token_},
+            log_{GetLogger("BotLog", kLogLevels.at(log_level))},
+            batch_size_{GetMetricsRegistry().GetHistogram(
+                    "telegram_updates_batch_size", {},
+                    "Updates received by one getUpdates call")}
+    {
+        Json::CharReaderBuilder reader_builder;
+        reader_builder["collectComments"] = false;
+        json_reader_.reset(reader_builder.newCharReader());
+
+        for (size_t i = 0; i < requests_.size(); ++i) {
+            auto method = static_cast<ApiMethod>(i);
+            auto& request = requests_[i];
+            request.setVersion(HTTPMessage::HTTP_1_1);
+            request.setURI(paths_.Path(method));
+
+            if (method == ApiMethod::GetMe || method == ApiMethod::GetUpdates) {
+                request.setMethod(HTTPRequest::HTTP_GET);
+                request.set("Accept-Encoding", "gzip");
+            } else {
+                request.setMethod(HTTPRequest::HTTP_POST);
+                request.setContentType("application/json");
+            }
+        }
+    }
 
     void InitSession();
     void CloseSession();
     void AbortSession();
+    void SetPrewarmConnections(size_t count) { prewarm_connections_ = count; }
 
-    void CheckBotInfo();
+    User CheckBotInfo();
 
     User GetMe();
 
@@ -51,6 +219,14 @@ public:
             std::optional<int32_t> offset,
             std::optional<int32_t> timeout);
 
+    std::vector<Update> ParseUpdates(std::istream& response_stream);
+
+    void SetAllowedUpdates(const std::vector<std::string>& update_types) {
+        allowed_updates_ = update_types.empty() ? "" : EncodeAllowedUpdates(update_types);
+    }
+
+    void SetUpdatesLimit(std::optional<int32_t> limit) { updates_limit_ = limit; }
+
     //  TODO: add reply_markup parameter
     void SendMessage(
             int32_t chat_id,
@@ -63,6 +239,27 @@ public:
     //  TODO: add other parameters
     void SendSticker(int32_t chat_id, const std::string& file_id);
     void SendDocument(int32_t chat_id, const std::string& document);
+    void SendDocumentFile(int64_t chat_id, const std::string& path, const UploadProgress& progress) {
+        UploadFile(ApiMethod::SendDocument, send_document_metrics_, "document", chat_id, path, progress);
+    }
+    void SendStickerFile(int64_t chat_id, const std::string& path, const UploadProgress& progress) {
+        UploadFile(ApiMethod::SendSticker, send_sticker_metrics_, "sticker", chat_id, path, progress);
+    }
+
+    SendTemplate MakeSendMessageTemplate(const std::string& text);
+    SendTemplate MakeSendStickerTemplate(const std::string& file_id);
+    SendTemplate MakeSendDocumentTemplate(const std::string& document);
+    void Send(const SendTemplate::Encoded& encoded, int64_t chat_id);
+
+    void SetTransport(TransportBackend backend, size_t connections, size_t pipeline_depth);
+    void SendAsync(const SendTemplate::Encoded& encoded, int64_t chat_id, SendCallback callback);
+    void FlushSends();
+
+    uint16_t StartMetricsServer(uint16_t port);
+    Counter& GetUpdatesRetries() { return get_updates_metrics_.retries; }
+
+    void SetFastSendResponses(bool enabled) { fast_send_responses_ = enabled; }
+    void SetResponseCompression(bool enabled);
 
     Logger& log() { return log_; }
 
@@ -79,10 +276,36 @@ private:
             {"trace", Poco::Message::Priority::PRIO_TRACE}
     };
 
-    std::istream& GetRequest(const URI& uri);
-    std::istream& PostRequest(const URI& uri, const Json::Value& json);
-    Json::Value GetJsonFromStream(std::istream& istream);
-    URI GetRequestUri(const std::string& request);
+    std::unique_ptr<HTTPClientSession> MakeSession(bool connect);
+    std::unique_ptr<HTTPClientSession> TakeSpareSession();
+    void SaveTlsSession();
+
+    HTTPRequest& Request(ApiMethod method) { return requests_[static_cast<size_t>(method)]; }
+    std::istream& GetRequest(HTTPRequest& request, ApiMethodMetrics& metrics);
+    std::istream& PostRequest(
+            HTTPRequest& request,
+            const std::string& body,
+            ApiMethodMetrics& metrics);
+    SendTemplate MakeSendTemplate(
+            ApiMethod method,
+            ApiMethodMetrics& metrics,
+            const std::string& field,
+            const std::string& value);
+    void UploadFile(
+            ApiMethod method,
+            ApiMethodMetrics& metrics,
+            const std::string& field,
+            int64_t chat_id,
+            const std::string& path,
+            const UploadProgress& progress);
+    void RecordResponse(const HTTPResponse& response, ApiMethodMetrics& metrics);
+    const std::string& ReadBody(std::istream& istream, std::optional<int64_t> content_length);
+    const std::string& ReadResponseBody(std::istream& response_stream);
+    std::vector<Update> ParseUpdatesBody(const std::string& body);
+    Json::Value ParseJson(const std::string& body);
+    Json::Value GetJsonFromResponse(std::istream& response_stream);
+    void CheckSendResponse(std::istream& response_stream, ApiMethodMetrics& metrics);
+    std::optional<int64_t> ResponseContentLength() const;
     void CheckResponseJson(const Json::Value& json);
 
     Chat ConvertJsonToChat(const Json::Value& json);
@@ -122,153 +345,301 @@ private:
     std::string token_;
     std::string first_name_;
     std::string server_url_;
+    RequestPathTable paths_;
 
     std::unique_ptr<HTTPClientSession> psession_;
     Logger& log_;
+
+    //  Connected at the first InitSession, taken by later ones
+    size_t prewarm_connections_ = 0;
+    bool prewarmed_ = false;
+    std::deque<std::unique_ptr<HTTPClientSession>> spare_sessions_;
+
+    //  Idle upload sessions; uploads may run on several threads
+    std::mutex upload_mutex_;
+    std::vector<std::unique_ptr<HTTPClientSession>> upload_sessions_;
+    std::mt19937_64 upload_random_{std::random_device{}()};
+    //  Resumed by the next session after CloseSession. Upload threads
+    //  make sessions too, so it is only touched under the mutex.
+    std::mutex tls_session_mutex_;
+    Poco::Net::Session::Ptr tls_session_;
+
+    //  One reused request per method; getUpdates gets a new target per poll
+    std::array<HTTPRequest, static_cast<size_t>(ApiMethod::Count)> requests_;
+    RequestTargetBuffer target_buffer_;
+    std::string request_target_;
+    std::string allowed_updates_;
+    std::optional<int32_t> updates_limit_;
+
+    //  Response state reused by every request of this connection
+    HTTPResponse response_;
+    std::string response_buffer_;
+    std::unique_ptr<Json::CharReader> json_reader_;
+    bool fast_send_responses_ = false;
+
+    //  Request bodies are serialized here, keeping capacity between requests
+    std::string request_buffer_;
+
+    ApiMethodMetrics get_me_metrics_{"getMe"};
+    ApiMethodMetrics get_updates_metrics_{"getUpdates"};
+    ApiMethodMetrics send_message_metrics_{"sendMessage"};
+    ApiMethodMetrics send_sticker_metrics_{"sendSticker"};
+    ApiMethodMetrics send_document_metrics_{"sendDocument"};
+    Histogram& batch_size_;
+
+    std::unique_ptr<MetricsServer> metrics_server_;
+
+    //  SendAsync() backend, none for Poco. Declared last: its callbacks
+    //  use the metrics above until it is stopped.
+    std::unique_ptr<AsyncTransport> transport_;
 };
 
 void
 TelegramBotAPI::TelegramBotAPIImpl
 ::InitSession() {
-    log_.information("Initializing session..");
+    poco_information(log_, "Initializing session..");
+
+    if (!prewarmed_ && prewarm_connections_ > 0) {
+        prewarmed_ = true;
+        for (size_t i = 0; i < prewarm_connections_; ++i) {
+            try {
+                spare_sessions_.push_back(MakeSession(true));
+            } catch (Poco::Exception& e) {
+                //  The first request will connect and report the error
+                poco_warning(log_, "Connection warm-up failed: " + e.displayText());
+                break;
+            }
+        }
 
+        poco_information(log_, "Warmed up " + std::to_string(spare_sessions_.size())
+                               + " connections");
+    }
+
+    psession_ = TakeSpareSession();
+    if (!psession_) {
+        psession_ = MakeSession(false);
+    }
+
+    poco_information(log_, "Session initialization finished");
+}
+
+std::unique_ptr<HTTPClientSession>
+TelegramBotAPI::TelegramBotAPIImpl
+::MakeSession(
+        bool connect
+) {
     auto host_uri = URI(server_url_);
-    if (server_url_.substr(0, 5) == "https") {
-        psession_ = std::make_unique<HTTPSClientSession>(
+    if (server_url_.substr(0, 5) != "https") {
+        auto session = std::make_unique<ConnectableSession<HTTPClientSession>>(
                 host_uri.getHost(),
                 host_uri.getPort());
+        if (connect) {
+            session->Connect();
+        }
 
-    } else {
-        psession_ = std::make_unique<HTTPClientSession>(
-                host_uri.getHost(),
-                host_uri.getPort());
+        return session;
+    }
+
+    Poco::Net::Session::Ptr tls_session;
+    {
+        std::lock_guard<std::mutex> guard(tls_session_mutex_);
+        tls_session = tls_session_;
+    }
+
+    auto session = std::make_unique<ConnectableSession<HTTPSClientSession>>(
+            host_uri.getHost(),
+            host_uri.getPort(),
+            SharedTlsContext(),
+            tls_session);
+    if (connect) {
+        session->Connect();
+        Poco::Net::SecureStreamSocket(session->socket()).completeHandshake();
+
+        std::lock_guard<std::mutex> guard(tls_session_mutex_);
+        tls_session_ = session->sslSession();
     }
 
-    log_.information("Session initialization finished");
+    return session;
+}
+
+std::unique_ptr<HTTPClientSession>
+TelegramBotAPI::TelegramBotAPIImpl
+::TakeSpareSession() {
+    while (!spare_sessions_.empty()) {
+        auto session = std::move(spare_sessions_.front());
+        spare_sessions_.pop_front();
+
+        //  An idle connection is readable only if the server has closed it
+        if (session->connected() &&
+                !session->socket().poll(Poco::Timespan(0), Poco::Net::Socket::SELECT_READ)) {
+            return session;
+        }
+    }
+
+    return nullptr;
+}
+
+void
+TelegramBotAPI::TelegramBotAPIImpl
+::SaveTlsSession() {
+    if (auto https_session = dynamic_cast<HTTPSClientSession*>(psession_.get())) {
+        if (auto tls_session = https_session->sslSession()) {
+            std::lock_guard<std::mutex> guard(tls_session_mutex_);
+            tls_session_ = tls_session;
+        }
+    }
 }
 
 void
 TelegramBotAPI::TelegramBotAPIImpl
 ::CloseSession() {
-    log_.information("Closing session..");
+    poco_information(log_, "Closing session..");
 
+    SaveTlsSession();
     psession_.reset();
 
-    log_.information("Session closing finished");
+    poco_information(log_, "Session closing finished");
 }
 
 void
 TelegramBotAPI::TelegramBotAPIImpl
 ::AbortSession() {
-    log_.information("Aborting session..");
+    poco_information(log_, "Aborting session..");
 
+    SaveTlsSession();
     psession_->abort();
 
-    log_.information("Session aborting finished");
+    poco_information(log_, "Session aborting finished");
 }
 
-void
+User
 TelegramBotAPI::TelegramBotAPIImpl
 ::CheckBotInfo() {
-    log_.information("Checking bot info..");
+    poco_information(log_, "Checking bot info..");
 
     auto user = GetMe();
     if (!user.is_bot || user.first_name != first_name_) {
         std::string err_msg = "Wrong bot info: " + user.GetInfo();
-        log_.error(err_msg);
+        poco_error(log_, err_msg);
         throw Poco::LogicException(err_msg);
     }
 
-    log_.information("Checking bot info finished.");
+    poco_information(log_, "Checking bot info finished.");
+    return user;
 }
 
 User
 TelegramBotAPI::TelegramBotAPIImpl
 ::GetMe() {
-    log_.information("Sending GetMe..");
+    poco_information(log_, "Sending GetMe..");
+    ScopedApiRequest request_metrics(get_me_metrics_);
 
-    auto uri = GetRequestUri("getMe");
-    std::istream& response_stream = GetRequest(uri);
-    auto response_json = GetJsonFromStream(response_stream);
+    std::istream& response_stream = GetRequest(Request(ApiMethod::GetMe), get_me_metrics_);
+    auto parse_start = NowMicroseconds();
+    auto response_json = GetJsonFromResponse(response_stream);
     CheckResponseJson(response_json);
     auto user = ConvertJsonToUser(response_json["result"]);
+    get_me_metrics_.parse_time.Record(NowMicroseconds() - parse_start);
 
-    log_.debug("Response json got:\n" + response_json.toStyledString());
-    log_.information("Sending GetMe finished");
+    poco_debug(log_, "Response json got:\n" + response_json.toStyledString());
+    poco_information(log_, "Sending GetMe finished");
     return user;
 }
 
-std::string
-BuildGetUpdatesRequestString(
+std::vector<Update>
+TelegramBotAPI::TelegramBotAPIImpl
+::GetUpdates(
         std::optional<int32_t> offset,
         std::optional<int32_t> timeout
 ) {
-    if (offset && timeout) {
-        return "getUpdates?offset=" + std::to_string(offset.value())
-               + "&timeout=" + std::to_string(timeout.value());
-
-    } else if (offset) {
-        return "getUpdates?offset=" + std::to_string(offset.value());
-
-    } else if (timeout) {
-        return "getUpdates?timeout=" + std::to_string(timeout.value());
-
-    } else {
-        return "getUpdates";
+    poco_information(log_, "Getting updates..");
+    ScopedApiRequest request_metrics(get_updates_metrics_);
+
+    GetUpdatesQuery query;
+    query.offset = offset;
+    query.timeout = timeout;
+    query.limit = updates_limit_;
+    query.allowed_updates = allowed_updates_;
+
+    auto& request = Request(ApiMethod::GetUpdates);
+    request_target_.assign(target_buffer_.Build(paths_.Path(ApiMethod::GetUpdates), query));
+    request.setURI(request_target_);
+
+    TraceSpan receive_span("receive");
+    std::istream& response_stream = GetRequest(request, get_updates_metrics_);
+    const auto& body = ReadResponseBody(response_stream);
+    receive_span.Finish();
+
+    auto updates = ParseUpdatesBody(body);
+    if (!updates.empty()) {
+        receive_span.SetTraceIds(updates.front().update_id, updates.back().update_id);
     }
+
+    poco_information(log_, "Getting updates finished. Got "
+                           + std::to_string(updates.size()) + " updates.");
+    return updates;
 }
 
 std::vector<Update>
 TelegramBotAPI::TelegramBotAPIImpl
-::GetUpdates(
-        std::optional<int32_t> offset,
-        std::optional<int32_t> timeout
+::ParseUpdates(
+        std::istream& response_stream
 ) {
-    log_.information("Getting updates..");
-
-    std::string req_str = BuildGetUpdatesRequestString(offset, timeout);
+    return ParseUpdatesBody(ReadBody(response_stream, std::nullopt));
+}
 
-    auto uri = GetRequestUri(req_str);
-    std::istream& response_stream = GetRequest(uri);
-    auto response_json = GetJsonFromStream(response_stream);
+std::vector<Update>
+TelegramBotAPI::TelegramBotAPIImpl
+::ParseUpdatesBody(
+        const std::string& body
+) {
+    TraceSpan parse_span("parse");
+    auto parse_start = NowMicroseconds();
+    auto response_json = ParseJson(body);
     CheckResponseJson(response_json);
     auto updates = ConvertJsonToUpdates(response_json["result"]);
+    get_updates_metrics_.parse_time.Record(NowMicroseconds() - parse_start);
+    if (!updates.empty()) {
+        parse_span.SetTraceIds(updates.front().update_id, updates.back().update_id);
+    }
+    batch_size_.Record(updates.size());
 
-    log_.debug("Response json got:\n" + response_json.toStyledString());
-    log_.information("Getting updates finished. Got "
-                     + std::to_string(updates.size()) + " updates.");
+    poco_debug(log_, "Response json got:\n" + response_json.toStyledString());
     return updates;
 }
 
-Json::Value
-CreateJsonForSendMessage(
+void
+WriteSendMessageBody(
+        std::string& buffer,
         int32_t chat_id,
         const std::string& text,
-        std::optional<std::string> parse_mode,
+        const std::optional<std::string>& parse_mode,
         std::optional<bool> disable_web_page_preview,
         std::optional<bool> disable_notification,
         std::optional<int32_t> reply_to_message_id
 ) {
-    Json::Value json;
-    json["chat_id"] = chat_id;
-    json["text"] = text;
+    JsonWriter writer(buffer);
+    writer.BeginObject()
+          .IntField("chat_id", chat_id)
+          .StringField("text", text);
+
     if (parse_mode) {
-        json["parse_mode"] = parse_mode.value();
+        writer.StringField("parse_mode", parse_mode.value());
     }
 
     if (disable_web_page_preview) {
-        json["disable_web_page_preview"] = disable_web_page_preview.value();
+        writer.BoolField("disable_web_page_preview", disable_web_page_preview.value());
     }
 
     if (disable_notification) {
-        json["disable_notification"] = disable_notification.value();
+        writer.BoolField("disable_notification", disable_notification.value());
     }
 
     if (reply_to_message_id) {
-        json["reply_to_message_id"] = reply_to_message_id.value();
+        writer.IntField("reply_to_message_id", reply_to_message_id.value());
     }
 
-    return json;
+    writer.EndObject();
 }
 
 void
@@ -281,10 +652,11 @@ TelegramBotAPI::TelegramBotAPIImpl
         std::optional<bool> disable_notification,
         std::optional<int32_t> reply_to_message_id
 ) {
-    log_.information("Sending message..");
+    poco_information(log_, "Sending message..");
+    ScopedApiRequest request_metrics(send_message_metrics_);
 
-    auto uri = GetRequestUri("sendMessage");
-    Json::Value json = CreateJsonForSendMessage(
+    WriteSendMessageBody(
+            request_buffer_,
             chat_id,
             text,
             parse_mode,
@@ -292,12 +664,13 @@ TelegramBotAPI::TelegramBotAPIImpl
             disable_notification,
             reply_to_message_id);
 
-    std::istream& response_stream = PostRequest(uri, json);
-    auto response_json = GetJsonFromStream(response_stream);
-    CheckResponseJson(response_json);
+    TraceSpan send_span("send");
+    std::istream& response_stream = PostRequest(
+            Request(ApiMethod::SendMessage), request_buffer_, send_message_metrics_);
+    send_span.Finish();
 
-    log_.debug("Response json got:\n" + response_json.toStyledString());
-    log_.information("Sending message finished");
+    CheckSendResponse(response_stream, send_message_metrics_);
+    poco_information(log_, "Sending message finished");
 }
 
 void
@@ -306,20 +679,22 @@ TelegramBotAPI::TelegramBotAPIImpl
         int32_t chat_id,
         const std::string& file_id
 ) {
-    log_.information("Sending sticker..");
-    log_.debug("Sticker file id: " + file_id);
-
-    Json::Value json;
-    json["chat_id"] = chat_id;
-    json["sticker"] = file_id;
-
-    auto uri = GetRequestUri("sendSticker");
-    std::istream& response_stream = PostRequest(uri, json);
-    auto response_json = GetJsonFromStream(response_stream);
-    CheckResponseJson(response_json);
-
-    log_.debug("Response json got:\n" + response_json.toStyledString());
-    log_.information("Sending sticker finished");
+    poco_information(log_, "Sending sticker..");
+    ScopedApiRequest request_metrics(send_sticker_metrics_);
+    poco_debug(log_, "Sticker file id: " + file_id);
+
+    JsonWriter(request_buffer_).BeginObject()
+            .IntField("chat_id", chat_id)
+            .StringField("sticker", file_id)
+            .EndObject();
+
+    TraceSpan send_span("send");
+    std::istream& response_stream = PostRequest(
+            Request(ApiMethod::SendSticker), request_buffer_, send_sticker_metrics_);
+    send_span.Finish();
+
+    CheckSendResponse(response_stream, send_sticker_metrics_);
+    poco_information(log_, "Sending sticker finished");
 }
 
 void
@@ -328,47 +703,353 @@ TelegramBotAPI::TelegramBotAPIImpl
         int32_t chat_id,
         const std::string& document
 ) {
-    log_.information("Sending document..");
-    log_.debug("Document: " + document);
+    poco_information(log_, "Sending document..");
+    ScopedApiRequest request_metrics(send_document_metrics_);
+    poco_debug(log_, "Document: " + document);
+
+    JsonWriter(request_buffer_).BeginObject()
+            .IntField("chat_id", chat_id)
+            .StringField("document", document)
+            .EndObject();
+
+    TraceSpan send_span("send");
+    std::istream& response_stream = PostRequest(
+            Request(ApiMethod::SendDocument), request_buffer_, send_document_metrics_);
+    send_span.Finish();
+
+    CheckSendResponse(response_stream, send_document_metrics_);
+    poco_information(log_, "Sending sticker finished");
+}
 
-    Json::Value json;
-    json["chat_id"] = chat_id;
-    json["document"] = document;
+void
+TelegramBotAPI::TelegramBotAPIImpl
+::UploadFile(
+        ApiMethod method,
+        ApiMethodMetrics& metrics,
+        const std::string& field,
+        int64_t chat_id,
+        const std::string& path,
+        const UploadProgress& progress
+) {
+    poco_information(log_, "Uploading " + path + " with " + metrics.method + "..");
+    ScopedApiRequest request_metrics(metrics);
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::string err_msg = "Failed to open " + path + " for upload";
+        poco_error(log_, err_msg);
+        throw Poco::OpenFileException(err_msg);
+    }
+    int64_t file_size = file.tellg();
+    file.seekg(0);
+
+    std::unique_ptr<HTTPClientSession> session;
+    std::string boundary = "----blablabot";
+    {
+        std::lock_guard<std::mutex> guard(upload_mutex_);
+        if (!upload_sessions_.empty()) {
+            session = std::move(upload_sessions_.back());
+            upload_sessions_.pop_back();
+        } else {
+            session = MakeSession(false);
+        }
 
-    auto uri = GetRequestUri("sendDocument");
-    std::istream& response_stream = PostRequest(uri, json);
-    auto response_json = GetJsonFromStream(response_stream);
-    CheckResponseJson(response_json);
+        char digits[17];
+        auto end = std::to_chars(digits, digits + 16, upload_random_(), 16).ptr;
+        boundary.append(digits, end);
+    }
+
+    //  Everything but the file contents is known up front, so the request
+    //  has a Content-Length and goes out unchunked
+    std::string filename = path.substr(path.find_last_of('/') + 1);
+    std::string escaped_filename;
+    for (char c : filename) {
+        if (c == '"') {
+            escaped_filename += "%22";
+        } else if (c != '\r' && c != '\n') {
+            escaped_filename += c;
+        }
+    }
+
+    std::string head = "--" + boundary + "\r\n"
+            "Content-Disposition: form-data; name=\"chat_id\"\r\n\r\n" +
+            std::to_string(chat_id) + "\r\n"
+            "--" + boundary + "\r\n"
+            "Content-Disposition: form-data; name=\"" + field + "\"; filename=\"" +
+            escaped_filename + "\"\r\n"
+            "Content-Type: application/octet-stream\r\n\r\n";
+    std::string tail = "\r\n--" + boundary + "--\r\n";
+
+    HTTPRequest request(HTTPRequest::HTTP_POST, paths_.Path(method), HTTPMessage::HTTP_1_1);
+    request.setContentType("multipart/form-data; boundary=" + boundary);
+    request.setContentLength64(head.size() + file_size + tail.size());
+
+    TraceSpan send_span("upload");
+    std::ostream& request_stream = session->sendRequest(request);
+    request_stream.write(head.data(), head.size());
+
+    //  One chunk in memory at a time, whatever the file size
+    std::vector<char> chunk(kUploadChunkSize);
+    int64_t sent = 0;
+    while (sent < file_size) {
+        file.read(chunk.data(), std::min<int64_t>(chunk.size(), file_size - sent));
+        if (file.gcount() <= 0) {
+            //  The session is dropped mid-request, so the server sees a
+            //  truncated body and nothing is sent
+            std::string err_msg = path + " was truncated during upload";
+            poco_error(log_, err_msg);
+            throw Poco::FileException(err_msg);
+        }
+
+        request_stream.write(chunk.data(), file.gcount());
+        sent += file.gcount();
+        if (progress) {
+            progress(sent, file_size);
+        }
+    }
+    request_stream.write(tail.data(), tail.size());
+    send_span.Finish();
 
-    log_.debug("Response json got:\n" + response_json.toStyledString());
-    log_.information("Sending sticker finished");
+    HTTPResponse response;
+    std::istream& response_stream = session->receiveResponse(response);
+    std::string body;
+    Poco::StreamCopier::copyToString(response_stream, body);
+    RecordResponse(response, metrics);
+
+    SendResult result;
+    ReadSendResult(response.getStatus(), body, result);
+    if (!result.ok) {
+        std::string err_msg = "Upload of " + path + " with " + metrics.method +
+                " got response status: " + std::to_string(response.getStatus()) +
+                ", body: " + body;
+        poco_error(log_, err_msg);
+        throw ApiException(err_msg, response.getStatus(), result.retry_after);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(upload_mutex_);
+        upload_sessions_.push_back(std::move(session));
+    }
+    poco_information(log_, "Uploading " + path + " finished");
+}
+
+SendTemplate
+TelegramBotAPI::TelegramBotAPIImpl
+::MakeSendTemplate(
+        ApiMethod method,
+        ApiMethodMetrics& metrics,
+        const std::string& field,
+        const std::string& value
+) {
+    auto encoded = std::make_shared<SendTemplate::Encoded>(metrics, paths_.Path(method));
+
+    //  chat_id goes first, so the body splits around its value
+    JsonWriter writer(request_buffer_);
+    writer.BeginObject().Key("chat_id");
+    encoded->body_prefix = request_buffer_;
+    writer.Int(0).StringField(field, value).EndObject();
+    encoded->body_suffix = request_buffer_.substr(encoded->body_prefix.size() + 1);
+
+    return SendTemplate(std::move(encoded));
+}
+
+SendTemplate
+TelegramBotAPI::TelegramBotAPIImpl
+::MakeSendMessageTemplate(
+        const std::string& text
+) {
+    return MakeSendTemplate(ApiMethod::SendMessage, send_message_metrics_, "text", text);
+}
+
+SendTemplate
+TelegramBotAPI::TelegramBotAPIImpl
+::MakeSendStickerTemplate(
+        const std::string& file_id
+) {
+    return MakeSendTemplate(ApiMethod::SendSticker, send_sticker_metrics_, "sticker", file_id);
+}
+
+SendTemplate
+TelegramBotAPI::TelegramBotAPIImpl
+::MakeSendDocumentTemplate(
+        const std::string& document
+) {
+    return MakeSendTemplate(ApiMethod::SendDocument, send_document_metrics_, "document", document);
+}
+
+void
+TelegramBotAPI::TelegramBotAPIImpl
+::Send(
+        const SendTemplate::Encoded& encoded,
+        int64_t chat_id
+) {
+    poco_information(log_, "Sending " + encoded.metrics.method + " template..");
+    ScopedApiRequest request_metrics(encoded.metrics);
+
+    encoded.FormatBody(chat_id, request_buffer_);
+
+    TraceSpan send_span("send");
+    std::istream& response_stream = PostRequest(encoded.request, request_buffer_, encoded.metrics);
+    send_span.Finish();
+
+    CheckSendResponse(response_stream, encoded.metrics);
+    poco_information(log_, "Sending " + encoded.metrics.method + " template finished");
+}
+
+void
+TelegramBotAPI::TelegramBotAPIImpl
+::SetTransport(
+        TransportBackend backend,
+        size_t connections,
+        size_t pipeline_depth
+) {
+    //  Let the sends of the previous backend finish first
+    FlushSends();
+    transport_.reset();
+
+    if (backend == TransportBackend::Poco) {
+        return;
+    }
+
+    poco_information(log_, "Starting async transport with "
+                           + std::to_string(connections) + " connections, pipeline depth "
+                           + std::to_string(pipeline_depth) + "..");
+
+    TransportOptions options;
+    options.server_url = server_url_;
+    options.connections = connections;
+    options.pipeline_depth = pipeline_depth;
+    try {
+        if (backend == TransportBackend::Epoll) {
+            transport_ = MakeEpollTransport(options);
+        } else {
+#ifdef TELEGRAM_IO_URING
+            transport_ = MakeIoUringTransport(options);
+#else
+            throw Poco::NotImplementedException("Built without io_uring support (TELEGRAM_IO_URING)");
+#endif
+        }
+    } catch (const std::runtime_error& e) {
+        poco_error(log_, std::string("Async transport failed to start: ") + e.what());
+        throw Poco::IOException(e.what());
+    }
+}
+
+void
+TelegramBotAPI::TelegramBotAPIImpl
+::SendAsync(
+        const SendTemplate::Encoded& encoded,
+        int64_t chat_id,
+        SendCallback callback
+) {
+    SendResult result;
+    result.chat_id = chat_id;
+
+    if (transport_) {
+        TransportRequest request;
+        request.target = encoded.request.getURI();
+        encoded.FormatBody(chat_id, request.body);
+        poco_debug(log_, "Async POST request on uri '" + request.target + "' with json:" + request.body);
+
+        encoded.metrics.requests.Increment();
+        transport_->Submit(std::move(request), [
+                &metrics = encoded.metrics,
+                result = std::move(result),
+                start = NowMicroseconds(),
+                callback = std::move(callback)
+        ](TransportResponse& response) mutable {
+            metrics.latency.Record(NowMicroseconds() - start);
+            if (response.attempts > 1) {
+                metrics.retries.Increment(response.attempts - 1);
+            }
+            if (response.status == HTTPResponse::HTTP_OK) {
+                metrics.status_ok.Increment();
+            } else if (response.status != 0) {
+                metrics.ResponseStatus(response.status).Increment();
+            }
+
+            if (response.status != 0) {
+                metrics.response_bytes.Record(response.body.size());
+                ReadSendResult(response.status, response.body, result);
+                if (result.retry_after == 0) {
+                    result.retry_after = response.retry_after;
+                }
+            } else {
+                result.description = response.error;
+                result.maybe_delivered = response.sent;
+            }
+
+            if (!result.ok) {
+                metrics.errors.Increment();
+            }
+            callback(result);
+        });
+        return;
+    }
+
+    //  Poco: the blocking session, with failures reported like above
+    {
+        ScopedApiRequest request_metrics(encoded.metrics);
+        try {
+            encoded.FormatBody(chat_id, request_buffer_);
+            encoded.request.setContentLength(request_buffer_.size());
+            std::ostream& request_stream = psession_->sendRequest(encoded.request);
+            request_stream.write(request_buffer_.data(), request_buffer_.size());
+            result.maybe_delivered = true;
+
+            std::istream& response_stream = psession_->receiveResponse(response_);
+            RecordResponse(response_, encoded.metrics);
+            result.maybe_delivered = false;
+            ReadSendResult(response_.getStatus(), ReadResponseBody(response_stream), result);
+        } catch (Poco::Exception& e) {
+            //  The connection may be mid-response; the next request reconnects
+            psession_->reset();
+            result.description = e.displayText();
+        }
+
+        if (!result.ok) {
+            encoded.metrics.errors.Increment();
+        }
+    }
+
+    callback(result);
+}
+
+void
+TelegramBotAPI::TelegramBotAPIImpl
+::FlushSends() {
+    if (transport_) {
+        transport_->Flush();
+    }
 }
 
 std::istream&
 TelegramBotAPI::TelegramBotAPIImpl
 ::GetRequest(
-        const URI& uri
+        HTTPRequest& request,
+        ApiMethodMetrics& metrics
 ) {
-    log_.debug("GET request on uri '" + uri.toString() + "'");
+    poco_debug(log_, "GET request on uri '" + request.getURI() + "'");
 
-    HTTPRequest request(
-            HTTPRequest::HTTP_GET,
-            uri.getPathAndQuery(),
-            HTTPMessage::HTTP_1_1);
-    auto tmp = request.getURI();
     psession_->sendRequest(request);
 
-    HTTPResponse response;
-    std::istream& response_stream = psession_->receiveResponse(response);
-    if (response.getStatus() != HTTPResponse::HTTP_OK) {
+    std::istream& response_stream = psession_->receiveResponse(response_);
+    RecordResponse(response_, metrics);
+    if (response_.getStatus() != HTTPResponse::HTTP_OK) {
+        //  Read the body out so the kept-alive connection stays usable;
+        //  error bodies are compressed like any other
+        const auto& body = ReadResponseBody(response_stream);
+
         std::string err_msg = "GET request with uri '" +
-                uri.toString() + "' got response status: " +
-                std::to_string(response.getStatus()) + ", reason: " +
-                response.getReason() + ". Expected " +
+                request.getURI() + "' got response status: " +
+                std::to_string(response_.getStatus()) + ", reason: " +
+                response_.getReason() + ", body: " + body + ". Expected " +
                 std::to_string(HTTPResponse::HTTP_OK);
 
-        log_.error(err_msg);
-        throw Poco::Net::HTTPException(err_msg);
+        poco_error(log_, err_msg);
+        SendResult result;
+        ReadSendResult(response_.getStatus(), body, result);
+        throw ApiException(err_msg, response_.getStatus(), result.retry_after);
     }
 
     return response_stream;
@@ -377,45 +1058,163 @@ TelegramBotAPI::TelegramBotAPIImpl
 std::istream&
 TelegramBotAPI::TelegramBotAPIImpl
 ::PostRequest(
-        const URI& uri,
-        const Json::Value& json
+        HTTPRequest& request,
+        const std::string& body,
+        ApiMethodMetrics& metrics
 ) {
-    auto json_str = json.toStyledString();
-    log_.debug("POST request on uri '" + uri.toString() + "' with json:" + json_str);
-    HTTPRequest request(HTTPRequest::HTTP_POST,
-                        uri.getPathAndQuery(),
-                        HTTPMessage::HTTP_1_1);
-
-    request.setContentType("application/json");
-    request.setContentLength(json_str.size());
+    poco_debug(log_, "POST request on uri '" + request.getURI() + "' with json:" + body);
+    request.setContentLength(body.size());
     std::ostream& request_stream = psession_->sendRequest(request);
-    request_stream << json_str;
-
-    HTTPResponse response;
-    std::istream& response_stream = psession_->receiveResponse(response);
-    if (response.getStatus() != HTTPResponse::HTTP_OK) {
-        std::string err_msg = "POST request with uri '" + uri.toString() +
-                "' and json value:\n" + json_str + "\ngot response status: " +
-                std::to_string(response.getStatus()) + ", reason: " +
-                response.getReason() + ". Expected " +
+    request_stream.write(body.data(), body.size());
+
+    std::istream& response_stream = psession_->receiveResponse(response_);
+    RecordResponse(response_, metrics);
+    if (response_.getStatus() != HTTPResponse::HTTP_OK) {
+        //  Read the body out so the kept-alive connection stays usable;
+        //  error bodies are compressed like any other
+        const auto& response_body = ReadResponseBody(response_stream);
+
+        std::string err_msg = "POST request with uri '" + request.getURI() +
+                "' and json value:\n" + body + "\ngot response status: " +
+                std::to_string(response_.getStatus()) + ", reason: " +
+                response_.getReason() + ", body: " + response_body + ". Expected " +
                 std::to_string(HTTPResponse::HTTP_OK);
 
-        log_.error(err_msg);
-        throw Poco::Net::HTTPException(err_msg);
+        poco_error(log_, err_msg);
+        SendResult result;
+        ReadSendResult(response_.getStatus(), response_body, result);
+        throw ApiException(err_msg, response_.getStatus(), result.retry_after);
     }
 
     return response_stream;
 }
 
+void
+TelegramBotAPI::TelegramBotAPIImpl
+::RecordResponse(
+        const HTTPResponse& response,
+        ApiMethodMetrics& metrics
+) {
+    if (response.getStatus() == HTTPResponse::HTTP_OK) {
+        metrics.status_ok.Increment();
+    } else {
+        metrics.ResponseStatus(response.getStatus()).Increment();
+    }
+
+    if (response.hasContentLength()) {
+        metrics.response_bytes.Record(response.getContentLength64());
+    }
+}
+
+void
+TelegramBotAPI::TelegramBotAPIImpl
+::SetResponseCompression(
+        bool enabled
+) {
+    for (auto method : {ApiMethod::GetMe, ApiMethod::GetUpdates}) {
+        if (enabled) {
+            Request(method).set("Accept-Encoding", "gzip");
+        } else {
+            Request(method).erase("Accept-Encoding");
+        }
+    }
+}
+
+uint16_t
+TelegramBotAPI::TelegramBotAPIImpl
+::StartMetricsServer(
+        uint16_t port
+) {
+    poco_information(log_, "Starting metrics server..");
+
+    metrics_server_ = std::make_unique<MetricsServer>(port);
+    metrics_server_->Start();
+
+    poco_information(log_, "Metrics server is listening on port "
+                           + std::to_string(metrics_server_->GetPort()));
+    return metrics_server_->GetPort();
+}
+
+std::optional<int64_t>
+TelegramBotAPI::TelegramBotAPIImpl
+::ResponseContentLength() const {
+    if (!response_.hasContentLength()) {
+        return std::nullopt;
+    }
+
+    return response_.getContentLength64();
+}
+
+const std::string&
+TelegramBotAPI::TelegramBotAPIImpl
+::ReadBody(
+        std::istream& istream,
+        std::optional<int64_t> content_length
+) {
+    //  clear() and resize() keep the capacity, so after the largest
+    //  response has been seen the buffer is never reallocated
+    response_buffer_.clear();
+    if (!content_length) {
+        Poco::StreamCopier::copyToString(istream, response_buffer_);
+        return response_buffer_;
+    }
+
+    response_buffer_.resize(content_length.value());
+    istream.read(response_buffer_.data(), content_length.value());
+    if (istream.gcount() != content_length.value()) {
+        std::string err_msg = "Response body is truncated: got " +
+                std::to_string(istream.gcount()) + " of " +
+                std::to_string(content_length.value()) + " bytes";
+
+        poco_error(log_, err_msg);
+        throw Poco::DataFormatException(err_msg);
+    }
+
+    return response_buffer_;
+}
+
+const std::string&
+TelegramBotAPI::TelegramBotAPIImpl
+::ReadResponseBody(
+        std::istream& response_stream
+) {
+    std::optional<Poco::InflatingStreamBuf::StreamType> stream_type;
+    if (response_.has("Content-Encoding")) {
+        const auto& encoding = response_.get("Content-Encoding");
+        if (encoding == "gzip") {
+            stream_type = Poco::InflatingStreamBuf::STREAM_GZIP;
+        } else if (encoding == "deflate") {
+            stream_type = Poco::InflatingStreamBuf::STREAM_ZLIB;
+        } else if (encoding != "identity") {
+            std::string err_msg = "Unsupported response Content-Encoding: " + encoding;
+            poco_error(log_, err_msg);
+            throw Poco::DataFormatException(err_msg);
+        }
+    }
+
+    if (!stream_type) {
+        return ReadBody(response_stream, ResponseContentLength());
+    }
+
+    //  Content-Length counts compressed bytes, so the body is inflated
+    //  until the end of the compressed stream
+    Poco::InflatingInputStream inflating_stream(response_stream, stream_type.value());
+    ReadBody(inflating_stream, std::nullopt);
+
+    //  Consume what zlib left unread (e.g. a trailing newline),
+    //  otherwise the next response on this connection is misread
+    response_stream.ignore(std::numeric_limits<std::streamsize>::max());
+    return response_buffer_;
+}
+
 Json::Value
 TelegramBotAPI::TelegramBotAPIImpl
-::GetJsonFromStream(
-        std::istream& istream
+::ParseJson(
+        const std::string& body
 ) {
     Json::Value result;
-    Json::CharReaderBuilder reader_builder;
     std::string errs;
-    if (!Json::parseFromStream(reader_builder, istream, &result, &errs)) {
+    if (!json_reader_->parse(body.data(), body.data() + body.size(), &result, &errs)) {
         std::string err_msg = "Json parsing error. Errors: " + errs;
         throw Poco::RuntimeException(err_msg);
     }
@@ -423,12 +1222,62 @@ TelegramBotAPI::TelegramBotAPIImpl
     return result;
 }
 
-URI
+bool
+HasOkTruePrefix(
+        std::string_view body
+) {
+    size_t pos = 0;
+    auto skip_spaces = [&] {
+        while (pos < body.size() && std::isspace(static_cast<unsigned char>(body[pos]))) {
+            ++pos;
+        }
+    };
+    auto expect = [&](std::string_view token) {
+        skip_spaces();
+        if (body.substr(pos, token.size()) != token) {
+            return false;
+        }
+
+        pos += token.size();
+        return true;
+    };
+
+    return expect("{") && expect("\"ok\"") && expect(":") && expect("true") &&
+           (expect(",") || expect("}"));
+}
+
+void
+TelegramBotAPI::TelegramBotAPIImpl
+::CheckSendResponse(
+        std::istream& response_stream,
+        ApiMethodMetrics& metrics
+) {
+    TraceSpan check_span("check");
+    auto parse_start = NowMicroseconds();
+    const auto& body = ReadResponseBody(response_stream);
+
+    //  The result of a send is never used, so a response that starts
+    //  with "ok": true needs no parsing. Anything else is parsed in full
+    //  to report what went wrong.
+    if (fast_send_responses_ && HasOkTruePrefix(body)) {
+        metrics.parse_time.Record(NowMicroseconds() - parse_start);
+        poco_debug(log_, "Response got:\n" + body);
+        return;
+    }
+
+    auto response_json = ParseJson(body);
+    CheckResponseJson(response_json);
+    metrics.parse_time.Record(NowMicroseconds() - parse_start);
+
+    poco_debug(log_, "Response json got:\n" + response_json.toStyledString());
+}
+
+Json::Value
 TelegramBotAPI::TelegramBotAPIImpl
-::GetRequestUri(
-        const std::string& request
+::GetJsonFromResponse(
+        std::istream& response_stream
 ) {
-    return URI(server_url_ + "bot" + token_ + "/" + request);
+    return ParseJson(ReadResponseBody(response_stream));
 }
 
 void
@@ -443,8 +1292,8 @@ TelegramBotAPI::TelegramBotAPIImpl
             err_msg += member + ", ";
         }
 
-        log_.error(err_msg);
-        log_.debug(json.toStyledString());
+        poco_error(log_, err_msg);
+        poco_debug(log_, json.toStyledString());
         throw Poco::DataFormatException(err_msg);
     }
 
@@ -453,8 +1302,8 @@ TelegramBotAPI::TelegramBotAPIImpl
                               std::to_string(Json::ValueType::booleanValue) +
                               ". Expected: bool.";
 
-        log_.error(err_msg);
-        log_.debug(json.toStyledString());
+        poco_error(log_, err_msg);
+        poco_debug(log_, json.toStyledString());
         throw Poco::DataFormatException(err_msg);
     }
 
@@ -462,8 +1311,8 @@ TelegramBotAPI::TelegramBotAPIImpl
         std::string err_msg = "Response json has false 'ok' field. "
                 "Expected true.";
 
-        log_.error(err_msg);
-        log_.debug(json.toStyledString());
+        poco_error(log_, err_msg);
+        poco_debug(log_, json.toStyledString());
         throw Poco::RuntimeException(err_msg);
     }
 
@@ -474,8 +1323,8 @@ TelegramBotAPI::TelegramBotAPIImpl
             err_msg += member + ", ";
         }
 
-        log_.error(err_msg);
-        log_.debug(json.toStyledString());
+        poco_error(log_, err_msg);
+        poco_debug(log_, json.toStyledString());
         throw Poco::DataFormatException(err_msg);
     }
 }
@@ -491,8 +1340,8 @@ TelegramBotAPI::TelegramBotAPIImpl
         std::string err_msg = "Json value has no field '" +
                               value_name + "'";
 
-        log_.error(err_msg);
-        log_.debug("Json value:\n" + json.toStyledString());
+        poco_error(log_, err_msg);
+        poco_debug(log_, "Json value:\n" + json.toStyledString());
         throw Poco::DataFormatException(err_msg);
     }
 
@@ -501,7 +1350,7 @@ TelegramBotAPI::TelegramBotAPIImpl
                 value_name + "' type (" + std::to_string(json.type()) +
                 ") isn't match. Expected " + std::to_string(value_type);
 
-        log_.error(err_msg);
+        poco_error(log_, err_msg);
         throw Poco::DataFormatException(err_msg);
     }
 }
@@ -872,12 +1721,12 @@ TelegramBotAPI::TelegramBotAPIImpl::
 ConvertJsonToUpdates(
         const Json::Value& json
 ) {
-    log_.debug(json.toStyledString());
+    poco_debug(log_, json.toStyledString());
     if (json.type() != Json::ValueType::arrayValue) {
         std::string err_msg = "Json value is " + std::to_string(json.type()) +
                 ". Expected " + std::to_string(Json::ValueType::arrayValue);
 
-        log_.error(err_msg);
+        poco_error(log_, err_msg);
         throw Poco::DataFormatException(err_msg);
     }
 
@@ -887,9 +1736,9 @@ ConvertJsonToUpdates(
         try {
             updates.push_back(ConvertJsonToUpdate(upd));
         } catch (Poco::Exception& e) {
-            log_.warning("Failed to handle update:" + e.displayText() +
-                                 ". Skipped.");
-            log_.debug("Update data:\n" + upd.toStyledString());
+            poco_warning(log_, "Failed to handle update:" + e.displayText() +
+                               ". Skipped.");
+            poco_debug(log_, "Update data:\n" + upd.toStyledString());
         }
     }
 
@@ -942,6 +1791,14 @@ AbortSession() {
 
 void
 TelegramBotAPI
+::SetPrewarmConnections(
+        size_t count
+) {
+    pimpl_->SetPrewarmConnections(count);
+}
+
+User
+TelegramBotAPI
 ::CheckBotInfo() {
     return pimpl_->CheckBotInfo();
 }
@@ -961,6 +1818,14 @@ GetUpdates(
     return pimpl_->GetUpdates(offset, timeout);
 }
 
+std::vector<Update>
+TelegramBotAPI
+::ParseUpdates(
+        std::istream& response_stream
+) {
+    return pimpl_->ParseUpdates(response_stream);
+}
+
 std::vector<Update>
 TelegramBotAPI
 ::GetUpdatesWithOffset(
@@ -1025,6 +1890,139 @@ TelegramBotAPI
     return pimpl_->SendDocument(chat_id, document);
 }
 
+void
+TelegramBotAPI
+::SendDocumentFile(
+        int64_t chat_id,
+        const std::string& path,
+        UploadProgress progress
+) {
+    return pimpl_->SendDocumentFile(chat_id, path, progress);
+}
+
+void
+TelegramBotAPI
+::SendStickerFile(
+        int64_t chat_id,
+        const std::string& path,
+        UploadProgress progress
+) {
+    return pimpl_->SendStickerFile(chat_id, path, progress);
+}
+
+SendTemplate
+TelegramBotAPI
+::MakeSendMessageTemplate(
+        const std::string& text
+) {
+    return pimpl_->MakeSendMessageTemplate(text);
+}
+
+SendTemplate
+TelegramBotAPI
+::MakeSendStickerTemplate(
+        const std::string& file_id
+) {
+    return pimpl_->MakeSendStickerTemplate(file_id);
+}
+
+SendTemplate
+TelegramBotAPI
+::MakeSendDocumentTemplate(
+        const std::string& document
+) {
+    return pimpl_->MakeSendDocumentTemplate(document);
+}
+
+void
+TelegramBotAPI
+::Send(
+        const SendTemplate& send_template,
+        int64_t chat_id
+) {
+    if (send_template.empty()) {
+        throw Poco::InvalidArgumentException("Empty send template");
+    }
+
+    return pimpl_->Send(send_template.encoded(), chat_id);
+}
+
+void
+TelegramBotAPI
+::SetTransport(
+        TransportBackend backend,
+        size_t connections,
+        size_t pipeline_depth
+) {
+    pimpl_->SetTransport(backend, connections, pipeline_depth);
+}
+
+void
+TelegramBotAPI
+::SendAsync(
+        const SendTemplate& send_template,
+        int64_t chat_id,
+        SendCallback callback
+) {
+    if (send_template.empty()) {
+        throw Poco::InvalidArgumentException("Empty send template");
+    }
+
+    pimpl_->SendAsync(send_template.encoded(), chat_id, std::move(callback));
+}
+
+void
+TelegramBotAPI
+::FlushSends() {
+    pimpl_->FlushSends();
+}
+
+void
+TelegramBotAPI
+::SetAllowedUpdates(
+        const std::vector<std::string>& update_types
+) {
+    pimpl_->SetAllowedUpdates(update_types);
+}
+
+void
+TelegramBotAPI
+::SetUpdatesLimit(
+        std::optional<int32_t> limit
+) {
+    pimpl_->SetUpdatesLimit(limit);
+}
+
+void
+TelegramBotAPI
+::SetFastSendResponses(
+        bool enabled
+) {
+    pimpl_->SetFastSendResponses(enabled);
+}
+
+void
+TelegramBotAPI
+::SetResponseCompression(
+        bool enabled
+) {
+    pimpl_->SetResponseCompression(enabled);
+}
+
+uint16_t
+TelegramBotAPI
+::StartMetricsServer(
+        uint16_t port
+) {
+    return pimpl_->StartMetricsServer(port);
+}
+
+Counter&
+TelegramBotAPI
+::GetUpdatesRetries() {
+    return pimpl_->GetUpdatesRetries();
+}
+
 Logger&
 TelegramBotAPI::
 log() {
@@ -2,10 +2,18 @@
 #define TELEGRAM_BOT_API_H
 
 
+#include "async_transport.h"
+
+#include <functional>
+#include <istream>
 #include <memory>
 #include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 #include <Poco/Logger.h>
+#include <Poco/Net/NetException.h>
 
 
 using Poco::Logger;
@@ -14,6 +22,12 @@ using Poco::Logger;
 constexpr auto kDefaultTelegramServerUrl = "https://api.telegram.org/";
 
 
+//  True if a response body starts with {"ok":true, whitespace allowed
+bool HasOkTruePrefix(std::string_view body);
+
+
+class Counter;
+
 struct Chat;
 struct Message;
 struct Sticker;
@@ -146,8 +160,70 @@ struct User {
 };
 
 
+//  send* request encoded once, with everything but chat_id fixed: path,
+//  headers and body around the chat_id value. For handlers that always
+//  reply the same thing. Created by TelegramBotAPI::Make*Template() and
+//  valid for the TelegramBotAPI that made it.
+class SendTemplate {
+public:
+    struct Encoded;
+
+    SendTemplate() = default;
+    explicit SendTemplate(std::shared_ptr<Encoded> encoded): encoded_{std::move(encoded)} {}
+
+    bool empty() const { return !encoded_; }
+    const Encoded& encoded() const { return *encoded_; }
+    //  telegram_request_retries_total of the template's method
+    Counter& retries() const;
+
+private:
+    std::shared_ptr<Encoded> encoded_;
+};
+
+
+//  Outcome of a SendAsync()
+struct SendResult {
+    int64_t chat_id = 0;
+    bool ok = false;
+    //  HTTP status, 0 if no response arrived
+    int status = 0;
+    //  No response, but the request was sent: the message may have been
+    //  delivered, and sending it again may deliver it twice
+    bool maybe_delivered = false;
+    //  From the response body when ok is false
+    int32_t error_code = 0;
+    std::string description;
+    //  Flood limit hit: seconds to wait before the next send
+    int32_t retry_after = 0;
+    //  The group became a supergroup with this id; resend there
+    int64_t migrate_to_chat_id = 0;
+};
+
+
+//  Non-200 response of the Bot API; code() is the HTTP status
+class ApiException : public Poco::Net::HTTPException {
+public:
+    ApiException(const std::string& msg, int status, int32_t retry_after = 0);
+
+    //  Flood limit hit: seconds to wait before the next request
+    int32_t RetryAfter() const { return retry_after_; }
+
+    const char* name() const noexcept override;
+    const char* className() const noexcept override;
+    Poco::Exception* clone() const override;
+    void rethrow() const override;
+
+private:
+    int32_t retry_after_;
+};
+
+
 class TelegramBotAPI {
 public:
+    using SendCallback = std::function<void(const SendResult& result)>;
+    //  Bytes of the file sent so far and the file size
+    using UploadProgress = std::function<void(int64_t sent, int64_t total)>;
+
     TelegramBotAPI(const std::string& token,
                    const std::string& first_name,
                    const std::string& log_level,
@@ -158,7 +234,14 @@ public:
     void CloseSession();
     void AbortSession();
 
-    void CheckBotInfo();
+    //  Connect `count` sessions, TLS handshakes included, at the first
+    //  InitSession. One serves requests; later InitSessions take the
+    //  remaining ones while the server keeps them open. Off by default.
+    void SetPrewarmConnections(size_t count);
+
+    //  Throws Poco::LogicException unless getMe returns a bot with the
+    //  expected first name. Returns the verified user.
+    User CheckBotInfo();
 
     User GetMe();
     std::vector<Update> GetUpdatesWithTimeout(int32_t timeout);
@@ -167,12 +250,64 @@ public:
             std::optional<int32_t> offset = std::nullopt,
             std::optional<int32_t> timeout = std::nullopt);
 
+    //  Sent with every getUpdates. Update types not listed are dropped
+    //  by the server (empty list: server default); limit is 1-100.
+    void SetAllowedUpdates(const std::vector<std::string>& update_types);
+    void SetUpdatesLimit(std::optional<int32_t> limit);
+
+    //  Parses getUpdates response body without any network activity
+    std::vector<Update> ParseUpdates(std::istream& response_stream);
+
     void SendMessage(int32_t chat_id, const std::string&);
     void SendMessage(int32_t chat_id, const std::string&, int32_t);
 
     void SendSticker(int32_t chat_id, const std::string& file_id);
     void SendDocument(int32_t chat_id, const std::string &document);
 
+    //  Upload a local file as multipart/form-data. The file is streamed
+    //  from disk in fixed-size chunks, never loaded whole. Uploads run on
+    //  their own kept-alive sessions, so several threads may upload at
+    //  once; `progress` runs on the uploading thread after every chunk.
+    //  Throws Poco::OpenFileException if the file cannot be read.
+    void SendDocumentFile(int64_t chat_id, const std::string& path, UploadProgress progress = nullptr);
+    void SendStickerFile(int64_t chat_id, const std::string& path, UploadProgress progress = nullptr);
+
+    SendTemplate MakeSendMessageTemplate(const std::string& text);
+    SendTemplate MakeSendStickerTemplate(const std::string& file_id);
+    SendTemplate MakeSendDocumentTemplate(const std::string& document);
+    void Send(const SendTemplate& send_template, int64_t chat_id);
+
+    //  Backend of SendAsync(). Poco (default) sends one request at a time
+    //  on the session of this object; Epoll and IoUring multiplex
+    //  `connections` kept-alive connections on their own event loop
+    //  thread. IoUring throws Poco::NotImplementedException unless built
+    //  with TELEGRAM_IO_URING. With pipeline_depth above 1 they send that
+    //  many requests per connection without waiting for the responses.
+    void SetTransport(TransportBackend backend, size_t connections = 8, size_t pipeline_depth = 1);
+
+    //  Queues a send and returns; failures are reported to the callback,
+    //  not thrown. The callback runs on the transport thread (inline with
+    //  Poco) and must not block.
+    void SendAsync(const SendTemplate& send_template, int64_t chat_id, SendCallback callback);
+    //  Waits for the callbacks of every SendAsync() so far
+    void FlushSends();
+
+    //  Accept send* responses by their {"ok":true prefix, without
+    //  parsing the returned message. Off by default.
+    void SetFastSendResponses(bool enabled);
+
+    //  Ask for gzip-compressed getMe and getUpdates responses; they are
+    //  inflated into the response buffer before parsing. On by default.
+    void SetResponseCompression(bool enabled);
+
+    //  Serves GET /metrics in Prometheus text format; port 0 binds an
+    //  ephemeral port. Returns the bound port.
+    uint16_t StartMetricsServer(uint16_t port);
+
+    //  telegram_request_retries_total of getUpdates, for callers that
+    //  poll again after an error
+    Counter& GetUpdatesRetries();
+
     Logger& log();
 
 private:
@@ -0,0 +1,334 @@
+#include "broadcast.h"
+#include "logger.h"
+#include "metrics.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <sstream>
+
+#include <Poco/Exception.h>
+
+
+namespace {
+
+constexpr auto kJournalMagic = "broadcast";
+
+//  FNV-1a over the chat ids, so that a journal is never applied to a
+//  different list
+uint64_t HashChats(const std::vector<int64_t>& chats) {
+    uint64_t hash = 14695981039346656037ull;
+    for (auto chat_id : chats) {
+        for (int i = 0; i < 8; ++i) {
+            hash = (hash ^ ((static_cast<uint64_t>(chat_id) >> (8 * i)) & 0xff)) * 1099511628211ull;
+        }
+    }
+
+    return hash;
+}
+
+Counter& OutcomeCounter(const std::string& outcome) {
+    return GetMetricsRegistry().GetCounter(
+            "telegram_broadcast_messages_total", {{"outcome", outcome}},
+            "Broadcast chats by outcome");
+}
+
+}  // namespace
+
+
+double BroadcastReport::Throughput() const {
+    auto finished = sent + blocked + migrated + deleted + failed;
+    return elapsed.count() > 0 ? finished * 1000.0 / elapsed.count() : 0;
+}
+
+std::string BroadcastReport::ToString() const {
+    std::ostringstream out;
+    out << "total: " << total << ", resumed: " << resumed
+        << ", sent: " << sent << ", blocked: " << blocked
+        << ", migrated: " << migrated << ", deleted: " << deleted
+        << ", failed: " << failed << ", unconfirmed: " << unconfirmed
+        << ", retries: " << retries
+        << ", elapsed: " << elapsed.count() << " ms"
+        << ", throughput: " << Throughput() << " msg/s";
+    return out.str();
+}
+
+
+Broadcast::Broadcast(TelegramBotAPI& api, BroadcastOptions options):
+        api_{api},
+        options_{std::move(options)}
+{}
+
+BroadcastReport Broadcast::Run(const SendTemplate& message) {
+    using Clock = std::chrono::steady_clock;
+
+    report_ = BroadcastReport();
+    retries_.clear();
+    retries_metric_ = &message.retries();
+    LoadChats();
+    LoadCheckpoint();
+    poco_information(api_.log(), "Broadcasting to " + std::to_string(report_.total - report_.resumed)
+                                 + " of " + std::to_string(report_.total) + " chats..");
+
+    api_.SetTransport(options_.backend, options_.connections, options_.pipeline_depth);
+
+    auto start = Clock::now();
+    auto interval = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(1 / std::max(options_.messages_per_second, 1e-3)));
+    auto next_send = start;
+    auto next_checkpoint = start + options_.checkpoint_interval;
+    paused_until_ = start;
+
+    size_t next_index = 0;
+    size_t in_flight = 0;
+    std::vector<std::pair<Job, SendResult>> results;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> guard(results_mutex_);
+            results.swap(results_);
+        }
+        for (auto& [job, result] : results) {
+            --in_flight;
+            if (!Classify(job, result)) {
+                retries_.push_back(job);
+            }
+        }
+        results.clear();
+
+        auto now = Clock::now();
+        while (in_flight < options_.max_in_flight && paused_until_ <= now && next_send <= now) {
+            Job job;
+            auto retry = std::find_if(retries_.begin(), retries_.end(), [now](const Job& job) {
+                return job.ready_at <= now;
+            });
+            if (retry != retries_.end()) {
+                job = *retry;
+                retries_.erase(retry);
+            } else {
+                while (next_index < chats_.size() && done_[next_index]) {
+                    ++next_index;
+                }
+                if (next_index == chats_.size()) {
+                    break;
+                }
+                job.index = next_index;
+                job.chat_id = chats_[next_index];
+                ++next_index;
+            }
+
+            ++job.attempts;
+            ++in_flight;
+            api_.SendAsync(message, job.chat_id, [this, job](const SendResult& result) {
+                {
+                    std::lock_guard<std::mutex> guard(results_mutex_);
+                    results_.emplace_back(job, result);
+                }
+                results_cv_.notify_one();
+            });
+
+            //  A late loop iteration may catch up by one message, no more
+            next_send = std::max(next_send, now - interval) + interval;
+        }
+
+        if (in_flight == 0 && retries_.empty() && next_index == chats_.size()) {
+            break;
+        }
+
+        if (now >= next_checkpoint) {
+            Checkpoint(false);
+            next_checkpoint = now + options_.checkpoint_interval;
+        }
+
+        auto wake_at = next_checkpoint;
+        if (in_flight < options_.max_in_flight) {
+            if (next_index < chats_.size()) {
+                wake_at = std::min(wake_at, std::max(next_send, paused_until_));
+            }
+            for (const auto& job : retries_) {
+                wake_at = std::min(wake_at, std::max({job.ready_at, next_send, paused_until_}));
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(results_mutex_);
+        results_cv_.wait_until(lock, wake_at, [this] {
+            return !results_.empty();
+        });
+    }
+
+    api_.FlushSends();
+    report_.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start);
+    Checkpoint(true);
+    return report_;
+}
+
+bool Broadcast::Classify(Job& job, const SendResult& result) {
+    auto now = std::chrono::steady_clock::now();
+    auto retry = [&](std::chrono::steady_clock::time_point ready_at) {
+        if (job.attempts >= options_.max_attempts) {
+            poco_warning(api_.log(), "Broadcast to " + std::to_string(job.chat_id) + " failed after "
+                                     + std::to_string(job.attempts) + " attempts: "
+                                     + result.description);
+            Finish(job, Outcome::Failed);
+            return true;
+        }
+
+        ++report_.retries;
+        retries_metric_->Increment();
+        job.ready_at = ready_at;
+        return false;
+    };
+
+    if (result.ok) {
+        Finish(job, job.migrated ? Outcome::Migrated : Outcome::Sent);
+        return true;
+    }
+
+    //  The flood limit is per bot, so every send waits
+    if (result.status == 429 || result.retry_after > 0) {
+        paused_until_ = std::max(paused_until_, now + std::chrono::seconds(std::max(result.retry_after, 1)));
+        return retry(paused_until_);
+    }
+
+    if (result.migrate_to_chat_id != 0 && !job.migrated) {
+        report_.migrations.emplace_back(job.chat_id, result.migrate_to_chat_id);
+        job.chat_id = result.migrate_to_chat_id;
+        job.migrated = true;
+        job.attempts = 0;
+        job.ready_at = now;
+        return false;
+    }
+
+    //  "Forbidden: bot was blocked by the user", "... kicked ...",
+    //  "Forbidden: user is deactivated" for deleted accounts
+    if (result.status == 403) {
+        Finish(job, result.description.find("deactivated") != std::string::npos
+                    ? Outcome::Deleted : Outcome::Blocked);
+        return true;
+    }
+
+    if (result.status == 400 && result.description.find("chat not found") != std::string::npos) {
+        Finish(job, Outcome::Deleted);
+        return true;
+    }
+
+    //  Only the operator can tell if a rerun is worth a duplicate
+    if (result.status == 0 && result.maybe_delivered) {
+        poco_warning(api_.log(), "Broadcast to " + std::to_string(job.chat_id)
+                                 + " may have been delivered: " + result.description);
+        ++report_.unconfirmed;
+        Finish(job, Outcome::Failed);
+        return true;
+    }
+
+    if (result.status == 0 || result.status >= 500) {
+        return retry(now + options_.retry_delay * (1 << std::min(job.attempts - 1, 6)));
+    }
+
+    poco_warning(api_.log(), "Broadcast to " + std::to_string(job.chat_id) + " failed: "
+                             + std::to_string(result.status) + " " + result.description);
+    Finish(job, Outcome::Failed);
+    return true;
+}
+
+void Broadcast::Finish(const Job& job, Outcome outcome) {
+    static auto& sent = OutcomeCounter("sent");
+    static auto& blocked = OutcomeCounter("blocked");
+    static auto& migrated = OutcomeCounter("migrated");
+    static auto& deleted = OutcomeCounter("deleted");
+    static auto& failed = OutcomeCounter("failed");
+
+    switch (outcome) {
+        case Outcome::Sent: ++report_.sent; sent.Increment(); break;
+        case Outcome::Blocked: ++report_.blocked; blocked.Increment(); break;
+        case Outcome::Migrated: ++report_.migrated; migrated.Increment(); break;
+        case Outcome::Deleted: ++report_.deleted; deleted.Increment(); break;
+        case Outcome::Failed: ++report_.failed; failed.Increment(); break;
+    }
+
+    done_[job.index] = outcome != Outcome::Failed;
+    journal_ << job.index << ' ' << static_cast<char>(outcome);
+    if (outcome == Outcome::Migrated) {
+        journal_ << ' ' << job.chat_id;
+    }
+    journal_ << '\n';
+}
+
+void Broadcast::Checkpoint(bool final) {
+    journal_.flush();
+    if (!journal_) {
+        throw Poco::FileException("Failed to write broadcast checkpoint " + options_.checkpoint_path);
+    }
+
+    auto message = "Broadcast " + std::string(final ? "finished" : "progress") + ": " + report_.ToString();
+    poco_information(api_.log(), message);
+}
+
+void Broadcast::LoadChats() {
+    std::ifstream fin(options_.chats_path);
+    if (!fin) {
+        throw Poco::FileException("Failed to open chat list " + options_.chats_path);
+    }
+
+    chats_.clear();
+    int64_t chat_id;
+    while (fin >> chat_id) {
+        chats_.push_back(chat_id);
+    }
+    if (!fin.eof()) {
+        throw Poco::DataFormatException("Invalid chat id in " + options_.chats_path + " after "
+                                        + std::to_string(chats_.size()) + " chats");
+    }
+
+    done_.assign(chats_.size(), false);
+    report_.total = chats_.size();
+}
+
+void Broadcast::LoadCheckpoint() {
+    std::string header = std::string(kJournalMagic) + " " + std::to_string(chats_.size()) + " "
+                         + std::to_string(HashChats(chats_));
+
+    if (journal_.is_open()) {
+        journal_.close();
+    }
+    journal_.clear();
+
+    std::ifstream fin(options_.checkpoint_path);
+    std::string line;
+    if (fin && std::getline(fin, line)) {
+        if (line != header) {
+            throw Poco::DataFormatException("Checkpoint " + options_.checkpoint_path +
+                                            " belongs to another chat list");
+        }
+
+        //  A line cut by a crash ends the journal, and is cut off
+        std::streamoff valid_size = fin.tellg();
+        while (std::getline(fin, line) && !fin.eof()) {
+            std::istringstream entry(line);
+            size_t index;
+            char outcome;
+            if (!(entry >> index >> outcome) || index >= chats_.size()) {
+                break;
+            }
+
+            int64_t new_chat_id;
+            if (outcome == static_cast<char>(Outcome::Migrated) && entry >> new_chat_id) {
+                report_.migrations.emplace_back(chats_[index], new_chat_id);
+            }
+            if (outcome != static_cast<char>(Outcome::Failed) && !done_[index]) {
+                done_[index] = true;
+                ++report_.resumed;
+            }
+            valid_size = fin.tellg();
+        }
+        fin.close();
+
+        std::filesystem::resize_file(options_.checkpoint_path, valid_size);
+        journal_.open(options_.checkpoint_path, std::ios::app);
+    } else {
+        journal_.open(options_.checkpoint_path, std::ios::trunc);
+        journal_ << header << std::endl;
+    }
+
+    if (!journal_) {
+        throw Poco::FileException("Failed to open broadcast checkpoint " + options_.checkpoint_path);
+    }
+}
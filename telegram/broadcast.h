@@ -0,0 +1,127 @@
+#ifndef TELEGRAM_BROADCAST_H
+#define TELEGRAM_BROADCAST_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "bot_api.h"
+
+
+struct BroadcastOptions {
+    //  One chat id per line
+    std::string chats_path;
+    //  Journal of finished chats. A broadcast started with an existing
+    //  journal skips what it lists.
+    std::string checkpoint_path;
+
+    //  Telegram allows about 30 messages per second to different chats
+    double messages_per_second = 30;
+    size_t max_in_flight = 256;
+
+    //  Poco sends one message at a time and needs InitSession() first
+    TransportBackend backend = TransportBackend::Epoll;
+    size_t connections = 8;
+    size_t pipeline_depth = 1;
+
+    //  Attempts per chat for flood limits, server errors and network
+    //  errors before the message was sent. A message lost after it was
+    //  sent fails at once, see BroadcastReport::unconfirmed.
+    int max_attempts = 5;
+    std::chrono::milliseconds retry_delay{1000};
+
+    //  How often the journal is flushed and progress is logged. Chats
+    //  finished since the last flush get the message again after a crash.
+    std::chrono::milliseconds checkpoint_interval{1000};
+};
+
+
+struct BroadcastReport {
+    int64_t total = 0;
+    //  Finished in earlier runs, according to the journal
+    int64_t resumed = 0;
+
+    int64_t sent = 0;
+    //  The bot was blocked or kicked
+    int64_t blocked = 0;
+    //  Sent to the supergroup the chat was migrated to
+    int64_t migrated = 0;
+    //  Chat or account does not exist
+    int64_t deleted = 0;
+    int64_t failed = 0;
+    //  Of the failed: sent, but no response arrived, so they may have
+    //  been delivered. A rerun sends them again.
+    int64_t unconfirmed = 0;
+    int64_t retries = 0;
+
+    //  Old and new chat ids, to update the chat list with
+    std::vector<std::pair<int64_t, int64_t>> migrations;
+
+    std::chrono::milliseconds elapsed{0};
+
+    //  Chats finished by this run per second
+    double Throughput() const;
+    std::string ToString() const;
+};
+
+
+//  Sends one message to every chat of a list, at most
+//  messages_per_second, over the async transport of `api`. Progress is
+//  journaled to checkpoint_path, so a run killed midway resumes where it
+//  stopped. Throws Poco::FileException if a file cannot be read or
+//  written, Poco::DataFormatException if the journal does not belong to
+//  the chat list.
+class Broadcast {
+public:
+    Broadcast(TelegramBotAPI& api, BroadcastOptions options);
+
+    BroadcastReport Run(const SendTemplate& message);
+
+private:
+    enum class Outcome : char {
+        Sent = 's',
+        Blocked = 'b',
+        Migrated = 'm',
+        Deleted = 'd',
+        Failed = 'f'
+    };
+
+    struct Job {
+        size_t index = 0;
+        int64_t chat_id = 0;
+        int attempts = 0;
+        bool migrated = false;
+        std::chrono::steady_clock::time_point ready_at;
+    };
+
+    void LoadChats();
+    void LoadCheckpoint();
+    void Finish(const Job& job, Outcome outcome);
+    //  Consumes a send result; false if the job has to be retried
+    bool Classify(Job& job, const SendResult& result);
+    void Checkpoint(bool final);
+
+    TelegramBotAPI& api_;
+    BroadcastOptions options_;
+
+    std::vector<int64_t> chats_;
+    std::vector<bool> done_;
+    std::ofstream journal_;
+    BroadcastReport report_;
+
+    //  Results come from the transport thread
+    std::mutex results_mutex_;
+    std::condition_variable results_cv_;
+    std::vector<std::pair<Job, SendResult>> results_;
+
+    std::deque<Job> retries_;
+    Counter* retries_metric_ = nullptr;
+    std::chrono::steady_clock::time_point paused_until_;
+};
+
+
+#endif //TELEGRAM_BROADCAST_H
@@ -0,0 +1,47 @@
+#include "broadcast.h"
+#include "logger.h"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+std::string ReadFirstWord(const std::string& path) {
+    std::string word;
+    std::ifstream inpFile(path);
+    inpFile >> word;
+    return word;
+}
+
+//  Sends <text> to every chat of <chats-file>, one id per line. Progress
+//  is kept in <chats-file>.checkpoint; rerunning after a crash resumes.
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "usage: " << argv[0] << " <chats-file> <text>" << std::endl;
+        return 1;
+    }
+
+    BroadcastOptions options;
+    options.chats_path = argv[1];
+    options.checkpoint_path = options.chats_path + ".checkpoint";
+    if (const char* rate = std::getenv("BROADCAST_RATE")) {
+        options.messages_per_second = std::stod(rate);
+    }
+    if (const char* connections = std::getenv("BROADCAST_CONNECTIONS")) {
+        options.connections = std::stoul(connections);
+    }
+    if (const char* depth = std::getenv("BROADCAST_PIPELINE_DEPTH")) {
+        options.pipeline_depth = std::stoul(depth);
+    }
+
+    TelegramBotAPI api(ReadFirstWord("token.txt"), ReadFirstWord("name.txt"), "information",
+                       kDefaultTelegramServerUrl);
+    Broadcast broadcast(api, options);
+    auto report = broadcast.Run(api.MakeSendMessageTemplate(argv[2]));
+
+    for (const auto& [old_chat_id, new_chat_id] : report.migrations) {
+        std::cout << "migrated " << old_chat_id << " " << new_chat_id << std::endl;
+    }
+    std::cout << report.ToString() << std::endl;
+    return report.failed == 0 ? 0 : 2;
+}
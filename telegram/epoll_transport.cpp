@@ -0,0 +1,258 @@
+#include "event_loop_transport.h"
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace {
+
+constexpr uint64_t kWakeId = ~uint64_t{0};
+constexpr int kMaxEvents = 256;
+constexpr size_t kReadBufferSize = 64 * 1024;
+
+
+//  Readiness-based backend: one epoll set with every pool socket and the
+//  wake eventfd. Sockets are read until EAGAIN and written as far as the
+//  kernel accepts; EPOLLOUT is armed only while a write is blocked.
+class EpollTransport : public EventLoopTransport {
+public:
+    explicit EpollTransport(const TransportOptions& options);
+    ~EpollTransport() override;
+
+private:
+    void Run() override;
+    void Connect(Connection& connection) override;
+    void Write(Connection& connection) override;
+    void CloseSocket(Connection& connection) override;
+
+    void HandleEvent(const epoll_event& event);
+    void ReadAvailable(Connection& connection);
+    void SetEvents(Connection& connection, uint32_t events, int op = EPOLL_CTL_MOD);
+    static uint64_t EventId(const Connection& connection);
+
+    int epoll_fd_ = -1;
+    std::string read_buffer_;
+};
+
+
+EpollTransport::
+EpollTransport(
+        const TransportOptions& options
+):
+        EventLoopTransport{options},
+        read_buffer_(kReadBufferSize, '\0')
+{
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        throw std::runtime_error(std::string("epoll_create1 failed: ") + strerror(errno));
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = kWakeId;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, WakeFd(), &event) < 0) {
+        close(epoll_fd_);
+        throw std::runtime_error(std::string("epoll_ctl failed: ") + strerror(errno));
+    }
+
+    StartLoop();
+}
+
+EpollTransport::
+~EpollTransport() {
+    StopLoop();
+    close(epoll_fd_);
+}
+
+uint64_t
+EpollTransport::
+EventId(
+        const Connection& connection
+) {
+    return connection.index | (uint64_t{connection.generation} << 32);
+}
+
+void
+EpollTransport::
+Run() {
+    epoll_event events[kMaxEvents];
+    while (!StopRequested()) {
+        Pump();
+        FlushWrites();
+
+        int timeout = -1;
+        auto deadline = NextDeadline();
+        if (deadline != Clock::time_point::max()) {
+            auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now());
+            timeout = static_cast<int>(std::max<int64_t>(left.count(), 0));
+        }
+
+        int count = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+        if (count < 0 && errno != EINTR) {
+            FailAll(std::string("epoll_wait failed: ") + strerror(errno));
+            return;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            HandleEvent(events[i]);
+        }
+    }
+
+    FailAll("Transport is stopped");
+}
+
+void
+EpollTransport::
+HandleEvent(
+        const epoll_event& event
+) {
+    if (event.data.u64 == kWakeId) {
+        DrainWakeFd();
+        return;
+    }
+
+    auto& connection = connections_[event.data.u64 & 0xffffffff];
+    if (connection.generation != event.data.u64 >> 32 ||
+            connection.state == Connection::State::Closed) {
+        return;
+    }
+
+    if (connection.state == Connection::State::Connecting) {
+        int error = 0;
+        socklen_t size = sizeof(error);
+        getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &size);
+        if (error != 0 || (event.events & (EPOLLERR | EPOLLHUP))) {
+            CloseConnection(connection, std::string("Connect failed: ") +
+                                        strerror(error ? error : ECONNREFUSED), true);
+            return;
+        }
+
+        connection.writing = false;
+        SetEvents(connection, EPOLLIN | EPOLLRDHUP);
+        OnConnected(connection);
+        return;
+    }
+
+    auto generation = connection.generation;
+    if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        ReadAvailable(connection);
+    }
+    if ((event.events & EPOLLOUT) && connection.generation == generation &&
+            connection.state != Connection::State::Closed) {
+        Write(connection);
+    }
+}
+
+void
+EpollTransport::
+ReadAvailable(
+        Connection& connection
+) {
+    auto generation = connection.generation;
+    while (connection.generation == generation) {
+        auto read = recv(connection.fd, read_buffer_.data(), read_buffer_.size(), 0);
+        if (read > 0) {
+            OnReceived(connection, read_buffer_.data(), read);
+            if (static_cast<size_t>(read) < read_buffer_.size()) {
+                return;
+            }
+        } else if (read == 0) {
+            OnEof(connection);
+            return;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return;
+        } else if (errno != EINTR) {
+            CloseConnection(connection, std::string("Receive failed: ") + strerror(errno),
+                            connection.state != Connection::State::Open);
+            return;
+        }
+    }
+}
+
+void
+EpollTransport::
+Connect(
+        Connection& connection
+) {
+    int result = connect(connection.fd, Address(), AddressSize());
+    if (result < 0 && errno != EINPROGRESS) {
+        CloseConnection(connection, std::string("Connect failed: ") + strerror(errno), true);
+        return;
+    }
+
+    //  Writable once connected, even if it did so immediately
+    connection.writing = true;
+    SetEvents(connection, EPOLLOUT | EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+}
+
+void
+EpollTransport::
+Write(
+        Connection& connection
+) {
+    if (connection.state == Connection::State::Connecting) {
+        return;
+    }
+
+    while (connection.out_offset < connection.out.size()) {
+        auto written = send(connection.fd, connection.out.data() + connection.out_offset,
+                            connection.out.size() - connection.out_offset, MSG_NOSIGNAL);
+        if (written >= 0) {
+            OnWritten(connection, written);
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            if (!connection.writing) {
+                connection.writing = true;
+                SetEvents(connection, EPOLLIN | EPOLLRDHUP | EPOLLOUT);
+            }
+            return;
+        } else if (errno != EINTR) {
+            CloseConnection(connection, std::string("Send failed: ") + strerror(errno));
+            return;
+        }
+    }
+
+    if (connection.writing) {
+        connection.writing = false;
+        SetEvents(connection, EPOLLIN | EPOLLRDHUP);
+    }
+}
+
+void
+EpollTransport::
+CloseSocket(
+        Connection& connection
+) {
+    if (connection.fd < 0) {
+        return;
+    }
+
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection.fd, nullptr);
+    close(connection.fd);
+}
+
+void
+EpollTransport::
+SetEvents(
+        Connection& connection,
+        uint32_t events,
+        int op
+) {
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = EventId(connection);
+    epoll_ctl(epoll_fd_, op, connection.fd, &event);
+}
+
+}  // namespace
+
+
+std::unique_ptr<AsyncTransport>
+MakeEpollTransport(
+        const TransportOptions& options
+) {
+    return std::make_unique<EpollTransport>(options);
+}
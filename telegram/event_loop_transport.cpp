@@ -0,0 +1,663 @@
+#include "event_loop_transport.h"
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace {
+
+constexpr auto kMaxReconnectDelay = std::chrono::milliseconds(5000);
+constexpr size_t kCompactThreshold = 64 * 1024;
+
+}  // namespace
+
+
+EventLoopTransport::
+EventLoopTransport(
+        const TransportOptions& options
+):
+        options_{options}
+{
+    //  "https://host:port/path"
+    std::string_view url = options_.server_url;
+    auto scheme_end = url.find("://");
+    if (scheme_end == std::string_view::npos) {
+        throw std::runtime_error("Invalid server url: " + options_.server_url);
+    }
+
+    tls_ = url.substr(0, scheme_end) == "https";
+    auto authority = url.substr(scheme_end + 3);
+    authority = authority.substr(0, authority.find('/'));
+
+    std::string port = tls_ ? "443" : "80";
+    auto colon = authority.rfind(':');
+    if (colon != std::string_view::npos) {
+        port = std::string(authority.substr(colon + 1));
+        authority = authority.substr(0, colon);
+    }
+    host_ = std::string(authority);
+    host_header_ = host_;
+    if (port != (tls_ ? "443" : "80")) {
+        host_header_ += ":" + port;
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (int error = getaddrinfo(host_.c_str(), port.c_str(), &hints, &addresses)) {
+        throw std::runtime_error("Failed to resolve " + host_ + ": " + gai_strerror(error));
+    }
+    std::memcpy(&address_, addresses->ai_addr, addresses->ai_addrlen);
+    address_size_ = addresses->ai_addrlen;
+    freeaddrinfo(addresses);
+
+    if (tls_) {
+        tls_context_ = std::make_unique<TlsContext>(options_.verify_peer);
+    }
+
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) {
+        throw std::runtime_error(std::string("eventfd failed: ") + strerror(errno));
+    }
+
+    connections_.resize(std::max<size_t>(options_.connections, 1));
+    for (size_t i = 0; i < connections_.size(); ++i) {
+        connections_[i].index = i;
+    }
+}
+
+EventLoopTransport::
+~EventLoopTransport() {
+    close(wake_fd_);
+}
+
+void
+EventLoopTransport::
+StartLoop() {
+    loop_ = std::thread([this] {
+        Run();
+    });
+}
+
+void
+EventLoopTransport::
+StopLoop() {
+    if (!loop_.joinable()) {
+        return;
+    }
+
+    stop_requested_.store(true, std::memory_order_release);
+    Wake();
+    loop_.join();
+    inbox_cv_.notify_all();
+}
+
+void
+EventLoopTransport::
+Submit(
+        TransportRequest request,
+        Callback callback
+) {
+    Pending pending{std::move(request), std::move(callback),
+                    Clock::now() + options_.request_timeout};
+
+    bool wake;
+    {
+        std::unique_lock<std::mutex> lock(inbox_mutex_);
+
+        //  Callbacks may submit, and the loop must never wait on itself
+        if (std::this_thread::get_id() != loop_.get_id()) {
+            inbox_cv_.wait(lock, [this] {
+                return submitted_ - completed_ < static_cast<int64_t>(options_.max_pending) ||
+                       StopRequested();
+            });
+        }
+
+        if (StopRequested()) {
+            lock.unlock();
+            TransportResponse response;
+            response.error = "Transport is stopped";
+            pending.callback(response);
+            return;
+        }
+
+        ++submitted_;
+        wake = inbox_.empty();
+        inbox_.push_back(std::move(pending));
+    }
+
+    if (wake) {
+        Wake();
+    }
+}
+
+void
+EventLoopTransport::
+Flush() {
+    std::unique_lock<std::mutex> lock(inbox_mutex_);
+    inbox_cv_.wait(lock, [this] {
+        return completed_ == submitted_;
+    });
+}
+
+void
+EventLoopTransport::
+Wake() {
+    uint64_t one = 1;
+    [[maybe_unused]] auto written = write(wake_fd_, &one, sizeof(one));
+}
+
+void
+EventLoopTransport::
+DrainWakeFd() {
+    uint64_t count;
+    while (read(wake_fd_, &count, sizeof(count)) > 0) {
+    }
+}
+
+void
+EventLoopTransport::
+Pump() {
+    {
+        std::lock_guard<std::mutex> guard(inbox_mutex_);
+        inbox_swap_.swap(inbox_);
+    }
+    for (auto& pending : inbox_swap_) {
+        pending_.push_back(std::move(pending));
+    }
+    inbox_swap_.clear();
+
+    auto now = Clock::now();
+
+    //  Requests sent again after a connection error go to the front, and
+    //  they are older, so the queue stays ordered by deadline
+    while (!pending_.empty() && pending_.front().deadline <= now) {
+        auto pending = std::move(pending_.front());
+        pending_.pop_front();
+
+        TransportResponse response;
+        response.error = "Request timed out in queue";
+        Complete(pending, response);
+    }
+
+    for (auto& connection : connections_) {
+        using State = Connection::State;
+        if ((connection.state == State::Connecting || connection.state == State::Handshaking) &&
+                connection.connect_deadline <= now) {
+            CloseConnection(connection, "Connect timed out", true);
+        } else if (connection.state == State::Open && !connection.in_flight.empty() &&
+                connection.in_flight.front().deadline <= now) {
+            CloseConnection(connection, "Request timed out");
+        }
+    }
+
+    Dispatch();
+}
+
+void
+EventLoopTransport::
+Dispatch() {
+    if (pending_.empty()) {
+        return;
+    }
+
+    //  Open connections for the requests the others cannot take
+    auto depth = std::max<size_t>(options_.pipeline_depth, 1);
+    size_t capacity = 0;
+    for (const auto& connection : connections_) {
+        if (connection.state == Connection::State::Connecting ||
+                connection.state == Connection::State::Handshaking) {
+            capacity += depth;
+        } else if (connection.state == Connection::State::Open) {
+            capacity += depth - std::min(depth, connection.in_flight.size());
+        }
+    }
+
+    auto now = Clock::now();
+    for (auto& connection : connections_) {
+        if (pending_.size() <= capacity) {
+            break;
+        }
+        if (connection.state == Connection::State::Closed && connection.retry_at <= now) {
+            OpenConnection(connection);
+            capacity += depth;
+        }
+    }
+
+    //  Round robin, one request per connection and pass, so that the
+    //  pipelines stay equally deep
+    bool sent = true;
+    while (sent && !pending_.empty()) {
+        sent = false;
+        for (size_t i = 0; i < connections_.size() && !pending_.empty(); ++i) {
+            auto& connection = connections_[(next_connection_ + i) % connections_.size()];
+            if (connection.state == Connection::State::Open && connection.in_flight.size() < depth) {
+                auto pending = std::move(pending_.front());
+                pending_.pop_front();
+                SendRequest(connection, std::move(pending));
+                sent = true;
+            }
+        }
+    }
+    next_connection_ = (next_connection_ + 1) % connections_.size();
+}
+
+void
+EventLoopTransport::
+OpenConnection(
+        Connection& connection
+) {
+    int fd = socket(address_.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        ++connection.connect_failures;
+        connection.retry_at = Clock::now() + kMaxReconnectDelay;
+        return;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    connection.fd = fd;
+    connection.state = Connection::State::Connecting;
+    connection.connect_deadline = Clock::now() + options_.connect_timeout;
+    Connect(connection);
+}
+
+void
+EventLoopTransport::
+OnConnected(
+        Connection& connection
+) {
+    if (!tls_) {
+        connection.state = Connection::State::Open;
+        return;
+    }
+
+    connection.state = Connection::State::Handshaking;
+    try {
+        connection.tls = std::make_unique<TlsSession>(*tls_context_, host_);
+        connection.tls->Handshake();
+        TakeCiphertext(connection);
+    } catch (const std::exception& e) {
+        CloseConnection(connection, e.what(), true);
+    }
+}
+
+void
+EventLoopTransport::
+SendRequest(
+        Connection& connection,
+        Pending pending
+) {
+    const auto& request = pending.request;
+    auto& buffer = connection.tls ? request_buffer_ : connection.out;
+    if (connection.tls) {
+        buffer.clear();
+    }
+    auto start = buffer.size();
+
+    buffer += request.method;
+    buffer += ' ';
+    buffer += request.target;
+    buffer += " HTTP/1.1\r\nHost: ";
+    buffer += host_header_;
+    buffer += "\r\n";
+    if (std::strcmp(request.method, "GET") != 0) {
+        buffer += "Content-Type: ";
+        buffer += request.content_type;
+        buffer += "\r\nContent-Length: ";
+        buffer += std::to_string(request.body.size());
+        buffer += "\r\n";
+    }
+    buffer += "\r\n";
+    buffer += request.body;
+
+    ++pending.attempts;
+    pending.wire_start = connection.wire_queued;
+    if (!connection.tls) {
+        connection.wire_queued += buffer.size() - start;
+        MarkDirty(connection);
+    } else {
+        try {
+            connection.tls->Write(buffer);
+            TakeCiphertext(connection);
+        } catch (const std::exception& e) {
+            pending_.push_front(std::move(pending));
+            CloseConnection(connection, e.what());
+            return;
+        }
+    }
+
+    pending.wire_end = connection.wire_queued;
+    connection.in_flight.push_back(std::move(pending));
+}
+
+void
+EventLoopTransport::
+MarkDirty(
+        Connection& connection
+) {
+    if (!connection.dirty) {
+        connection.dirty = true;
+        dirty_.push_back(connection.index);
+    }
+}
+
+void
+EventLoopTransport::
+TakeCiphertext(
+        Connection& connection
+) {
+    auto size = connection.out.size();
+    connection.tls->TakeCiphertext(connection.out);
+    if (connection.out.size() > size) {
+        connection.wire_queued += connection.out.size() - size;
+        MarkDirty(connection);
+    }
+}
+
+void
+EventLoopTransport::
+FlushWrites() {
+    //  Writes are collected over a whole loop iteration, so requests
+    //  queued together go out in one write
+    dirty_swap_.clear();
+    dirty_swap_.swap(dirty_);
+    for (auto index : dirty_swap_) {
+        auto& connection = connections_[index];
+        connection.dirty = false;
+        if (connection.state != Connection::State::Closed &&
+                connection.out_offset < connection.out.size()) {
+            Write(connection);
+        }
+    }
+}
+
+void
+EventLoopTransport::
+OnWritten(
+        Connection& connection,
+        size_t size
+) {
+    connection.out_offset += size;
+    connection.wire_written += size;
+
+    if (connection.out_offset == connection.out.size()) {
+        connection.out.clear();
+        connection.out_offset = 0;
+    } else if (connection.out_offset > kCompactThreshold &&
+               connection.out_offset > connection.out.size() / 2) {
+        connection.out.erase(0, connection.out_offset);
+        connection.out_offset = 0;
+    }
+}
+
+void
+EventLoopTransport::
+OnReceived(
+        Connection& connection,
+        const char* data,
+        size_t size
+) {
+    if (!connection.tls) {
+        ReceivePlaintext(connection, data, size);
+        return;
+    }
+
+    bool open;
+    connection.plaintext.clear();
+    try {
+        connection.tls->PutCiphertext(data, size);
+        if (connection.state == Connection::State::Handshaking) {
+            bool done = connection.tls->Handshake();
+            TakeCiphertext(connection);
+            if (!done) {
+                return;
+            }
+            connection.state = Connection::State::Open;
+        }
+
+        open = connection.tls->Read(connection.plaintext);
+        TakeCiphertext(connection);
+    } catch (const std::exception& e) {
+        CloseConnection(connection, e.what(),
+                        connection.state == Connection::State::Handshaking);
+        return;
+    }
+
+    auto generation = connection.generation;
+    if (!connection.plaintext.empty()) {
+        //  Moved out: completing a response may close the connection
+        std::string plaintext;
+        plaintext.swap(connection.plaintext);
+        ReceivePlaintext(connection, plaintext.data(), plaintext.size());
+        if (connection.generation == generation) {
+            connection.plaintext.swap(plaintext);
+        }
+    }
+
+    if (!open && connection.generation == generation) {
+        OnEof(connection);
+    }
+}
+
+void
+EventLoopTransport::
+ReceivePlaintext(
+        Connection& connection,
+        const char* data,
+        size_t size
+) {
+    auto generation = connection.generation;
+    size_t offset = 0;
+    while (offset < size) {
+        if (connection.in_flight.empty()) {
+            CloseConnection(connection, "Unexpected data from server");
+            return;
+        }
+
+        try {
+            offset += connection.parser.Feed(data + offset, size - offset);
+        } catch (const std::exception& e) {
+            CloseConnection(connection, std::string("Invalid response: ") + e.what());
+            return;
+        }
+
+        if (connection.parser.Done()) {
+            CompleteFront(connection);
+            if (connection.generation != generation) {
+                return;
+            }
+        }
+    }
+}
+
+void
+EventLoopTransport::
+OnEof(
+        Connection& connection
+) {
+    if (!connection.in_flight.empty() && connection.parser.Started() &&
+            connection.parser.FinishOnEof()) {
+        //  Body delimited by the close, the connection is closed with it
+        CompleteFront(connection);
+        return;
+    }
+
+    CloseConnection(connection, "Connection closed by server",
+                    connection.state != Connection::State::Open);
+}
+
+void
+EventLoopTransport::
+CompleteFront(
+        Connection& connection
+) {
+    auto pending = std::move(connection.in_flight.front());
+    connection.in_flight.pop_front();
+
+    auto& parser = connection.parser;
+    TransportResponse response;
+    response.sent = true;
+    response.status = parser.Status();
+    response.retry_after = parser.RetryAfter();
+    response.body = std::move(parser.Body());
+    bool keep_alive = parser.KeepAlive();
+    bool connection_close = parser.ConnectionClose();
+    parser.Reset();
+    connection.connect_failures = 0;
+
+    if (!keep_alive) {
+        //  Pipelined requests behind an explicit close were not processed
+        //  and are sent again; after any other close they may have been
+        while (connection_close && !connection.in_flight.empty()) {
+            pending_.push_front(std::move(connection.in_flight.back()));
+            connection.in_flight.pop_back();
+        }
+        CloseConnection(connection, "Connection closed by server");
+    }
+
+    Complete(pending, response);
+}
+
+void
+EventLoopTransport::
+Complete(
+        Pending& pending,
+        TransportResponse& response
+) {
+    response.attempts = pending.attempts;
+    pending.callback(response);
+
+    {
+        std::lock_guard<std::mutex> guard(inbox_mutex_);
+        ++completed_;
+    }
+    inbox_cv_.notify_all();
+}
+
+void
+EventLoopTransport::
+CloseConnection(
+        Connection& connection,
+        const std::string& error,
+        bool connect_failure
+) {
+    if (connection.state == Connection::State::Closed) {
+        return;
+    }
+
+    CloseSocket(connection);
+    connection.fd = -1;
+    connection.state = Connection::State::Closed;
+    ++connection.generation;
+    connection.tls.reset();
+    connection.out.clear();
+    connection.out_offset = 0;
+    connection.writing = false;
+    connection.parser.Reset();
+
+    auto now = Clock::now();
+    connection.retry_at = now;
+    if (connect_failure) {
+        ++connection.connect_failures;
+        auto delay = std::chrono::milliseconds(100 << std::min(connection.connect_failures, 6));
+        connection.retry_at += std::min<std::chrono::milliseconds>(delay, kMaxReconnectDelay);
+    }
+
+    auto in_flight = std::move(connection.in_flight);
+    connection.in_flight.clear();
+    auto written = connection.wire_written;
+    connection.wire_queued = 0;
+    connection.wire_written = 0;
+
+    //  A request none of whose bytes reached the socket cannot have been
+    //  seen by the server and is sent again. The rest fail: sending them
+    //  again could deliver them twice.
+    for (auto it = in_flight.rbegin(); it != in_flight.rend(); ++it) {
+        if (it->wire_start >= written) {
+            pending_.push_front(std::move(*it));
+        }
+    }
+
+    for (auto& pending : in_flight) {
+        if (pending.wire_start < written) {
+            TransportResponse response;
+            response.error = error;
+            response.sent = true;
+            Complete(pending, response);
+        }
+    }
+}
+
+void
+EventLoopTransport::
+FailAll(
+        const std::string& error
+) {
+    //  Also when the loop exits on an error: later Submit()s fail at once
+    stop_requested_.store(true, std::memory_order_release);
+    inbox_cv_.notify_all();
+
+    for (auto& connection : connections_) {
+        CloseConnection(connection, error);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(inbox_mutex_);
+        for (auto& pending : inbox_) {
+            pending_.push_back(std::move(pending));
+        }
+        inbox_.clear();
+    }
+
+    while (!pending_.empty()) {
+        auto pending = std::move(pending_.front());
+        pending_.pop_front();
+
+        TransportResponse response;
+        response.error = error;
+        Complete(pending, response);
+    }
+}
+
+EventLoopTransport::Clock::time_point
+EventLoopTransport::
+NextDeadline() const {
+    auto next = Clock::time_point::max();
+    if (!pending_.empty()) {
+        next = std::min(next, pending_.front().deadline);
+    }
+
+    for (const auto& connection : connections_) {
+        switch (connection.state) {
+            case Connection::State::Connecting:
+            case Connection::State::Handshaking:
+                next = std::min(next, connection.connect_deadline);
+                break;
+
+            case Connection::State::Open:
+                if (!connection.in_flight.empty()) {
+                    next = std::min(next, connection.in_flight.front().deadline);
+                }
+                break;
+
+            case Connection::State::Closed:
+                if (!pending_.empty()) {
+                    next = std::min(next, connection.retry_at);
+                }
+                break;
+        }
+    }
+
+    return next;
+}
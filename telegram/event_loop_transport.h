@@ -0,0 +1,154 @@
+#ifndef TELEGRAM_EVENT_LOOP_TRANSPORT_H
+#define TELEGRAM_EVENT_LOOP_TRANSPORT_H
+
+
+#include "async_transport.h"
+#include "http_parser.h"
+#include "tls_session.h"
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//  Backend-independent part of the event loop transports: connection
+//  pool, request queue, HTTP framing, TLS and timeouts. A backend does
+//  the socket I/O on the loop thread and reports back through the On*()
+//  methods; everything but Submit() and Flush() runs on that thread.
+class EventLoopTransport : public AsyncTransport {
+public:
+    ~EventLoopTransport() override;
+
+    void Submit(TransportRequest request, Callback callback) override;
+    void Flush() override;
+
+protected:
+    using Clock = std::chrono::steady_clock;
+
+    struct Pending {
+        TransportRequest request;
+        Callback callback;
+        Clock::time_point deadline;
+        //  Wire bytes of the connection before and after this request
+        uint64_t wire_start = 0;
+        uint64_t wire_end = 0;
+        int32_t attempts = 0;
+    };
+
+    struct Connection {
+        enum class State {
+            Closed,
+            Connecting,
+            Handshaking,
+            Open
+        };
+
+        size_t index = 0;
+        //  Changes on every close, so that stale events can be told apart
+        uint32_t generation = 0;
+        int fd = -1;
+        State state = State::Closed;
+        std::unique_ptr<TlsSession> tls;
+
+        //  Bytes for the socket, ciphertext with TLS. Everything before
+        //  out_offset has been written.
+        std::string out;
+        size_t out_offset = 0;
+        uint64_t wire_queued = 0;
+        uint64_t wire_written = 0;
+        bool dirty = false;
+        //  Backend state: a write is armed or in flight
+        bool writing = false;
+
+        std::deque<Pending> in_flight;
+        HttpResponseParser parser;
+        std::string plaintext;
+
+        Clock::time_point connect_deadline;
+        Clock::time_point retry_at;
+        int connect_failures = 0;
+    };
+
+    explicit EventLoopTransport(const TransportOptions& options);
+
+    //  Backend hooks
+    virtual void Run() = 0;
+    //  `connection.fd` is a fresh non-blocking socket
+    virtual void Connect(Connection& connection) = 0;
+    //  Write connection.out from out_offset, report with OnWritten()
+    virtual void Write(Connection& connection) = 0;
+    virtual void CloseSocket(Connection& connection) = 0;
+
+    //  Backends start the loop thread at the end of their constructor and
+    //  stop it at the start of their destructor
+    void StartLoop();
+    void StopLoop();
+    bool StopRequested() const { return stop_requested_.load(std::memory_order_acquire); }
+
+    //  Loop steps: queue submitted requests, expire timeouts, open
+    //  connections and hand requests to them
+    void Pump();
+    void FlushWrites();
+    //  Time of the next timeout the loop has to wake up for
+    Clock::time_point NextDeadline() const;
+    int WakeFd() const { return wake_fd_; }
+    const sockaddr* Address() const { return reinterpret_cast<const sockaddr*>(&address_); }
+    socklen_t AddressSize() const { return address_size_; }
+    void DrainWakeFd();
+
+    void OnConnected(Connection& connection);
+    void OnReceived(Connection& connection, const char* data, size_t size);
+    void OnWritten(Connection& connection, size_t size);
+    void OnEof(Connection& connection);
+    void CloseConnection(Connection& connection, const std::string& error, bool connect_failure = false);
+
+    //  Fails everything queued and in flight; called by Run() on exit
+    void FailAll(const std::string& error);
+
+    std::vector<Connection> connections_;
+
+private:
+    void Wake();
+    void Dispatch();
+    void OpenConnection(Connection& connection);
+    void SendRequest(Connection& connection, Pending pending);
+    void MarkDirty(Connection& connection);
+    void TakeCiphertext(Connection& connection);
+    void ReceivePlaintext(Connection& connection, const char* data, size_t size);
+    void CompleteFront(Connection& connection);
+    void Complete(Pending& pending, TransportResponse& response);
+
+    TransportOptions options_;
+    bool tls_ = false;
+    std::string host_;
+    std::string host_header_;
+    sockaddr_storage address_{};
+    socklen_t address_size_ = 0;
+    std::unique_ptr<TlsContext> tls_context_;
+
+    //  Submitted, not yet taken by the loop
+    std::mutex inbox_mutex_;
+    std::condition_variable inbox_cv_;
+    std::vector<Pending> inbox_;
+    std::vector<Pending> inbox_swap_;
+    int64_t submitted_ = 0;
+    int64_t completed_ = 0;
+
+    int wake_fd_ = -1;
+    std::atomic<bool> stop_requested_{false};
+    std::thread loop_;
+
+    std::deque<Pending> pending_;
+    std::vector<size_t> dirty_;
+    std::vector<size_t> dirty_swap_;
+    size_t next_connection_ = 0;
+    std::string request_buffer_;
+};
+
+
+#endif //TELEGRAM_EVENT_LOOP_TRANSPORT_H
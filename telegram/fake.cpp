@@ -1,16 +1,32 @@
 #include "fake.h"
 #include "fake_data.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
 #include <mutex>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <random>
+#include <set>
 #include <stdexcept>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
 
+#include <Poco/DeflatingStream.h>
 #include <Poco/URI.h>
 
+#include <Poco/Net/HTMLForm.h>
 #include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerRequestImpl.h>
 #include <Poco/Net/HTTPServerResponse.h>
 #include <Poco/Net/HTTPRequestHandler.h>
+#include <Poco/Net/MessageHeader.h>
+#include <Poco/Net/PartHandler.h>
 #include <Poco/Net/SocketAddress.h>
 
 #include <json/json.h>
@@ -22,22 +38,367 @@ using namespace Poco::Net;
 
 class CheckFailedException : public std::exception {};
 
+struct FaultDecision {
+    std::chrono::microseconds Latency{0};
+    size_t SlowBodyChunk = 0;
+    std::chrono::microseconds SlowBodyDelay{0};
+    bool Reset = false;
+    int Status = 0;
+    int RetryAfter = 0;
+};
+
+// Decision for the request handled by the current server thread.
+// TestCase::Reply reads it to slow down body writes.
+thread_local const FaultDecision* CurrentFault = nullptr;
+
+// Set when the server compresses replies and the client accepts gzip.
+thread_local bool CompressReply = false;
+
+std::string GzipBody(const std::string& body) {
+    std::ostringstream compressed;
+    DeflatingOutputStream deflater(compressed, DeflatingStreamBuf::STREAM_GZIP);
+    deflater << body;
+    deflater.close();
+    return compressed.str();
+}
+
+class FaultInjector {
+public:
+    void SetDefault(const FaultProfile& faults) {
+        std::lock_guard<std::mutex> guard(Mutex_);
+        Default_ = faults;
+        Enabled_ = true;
+    }
+
+    void Set(const std::string& endpoint, const FaultProfile& faults) {
+        std::lock_guard<std::mutex> guard(Mutex_);
+        Endpoints_[endpoint] = faults;
+        Enabled_ = true;
+    }
+
+    void Clear() {
+        std::lock_guard<std::mutex> guard(Mutex_);
+        Default_.reset();
+        Endpoints_.clear();
+        BurstLeft_.clear();
+        Enabled_ = false;
+    }
+
+    void Seed(uint64_t seed) {
+        std::lock_guard<std::mutex> guard(Mutex_);
+        Random_.seed(seed);
+    }
+
+    FaultStats GetStats() {
+        std::lock_guard<std::mutex> guard(Mutex_);
+        return Stats_;
+    }
+
+    FaultDecision Decide(const std::string& endpoint) {
+        FaultDecision decision;
+        if (!Enabled_.load(std::memory_order_acquire)) {
+            return decision;
+        }
+
+        std::lock_guard<std::mutex> guard(Mutex_);
+
+        const FaultProfile* profile = Find(endpoint);
+        if (!profile) {
+            return decision;
+        }
+
+        decision.Latency = SampleLatency(profile->Latency);
+        if (decision.Latency.count() > 0) {
+            ++Stats_.Delayed;
+        }
+
+        if (Roll(profile->ResetProbability)) {
+            decision.Reset = true;
+            ++Stats_.Resets;
+            return decision;
+        }
+
+        int& burst = BurstLeft_[endpoint];
+        if (burst == 0 && Roll(profile->ServerErrorBurstProbability)) {
+            burst = std::max(1, profile->ServerErrorBurstLength);
+        }
+
+        if (burst > 0) {
+            --burst;
+            decision.Status = profile->ServerErrorStatus;
+            ++Stats_.ServerErrors;
+            return decision;
+        }
+
+        if (Roll(profile->TooManyRequestsProbability)) {
+            decision.Status = HTTPResponse::HTTP_TOO_MANY_REQUESTS;
+            decision.RetryAfter = profile->RetryAfter;
+            ++Stats_.TooManyRequests;
+            return decision;
+        }
+
+        if (profile->SlowBodyChunk > 0) {
+            decision.SlowBodyChunk = profile->SlowBodyChunk;
+            decision.SlowBodyDelay = profile->SlowBodyDelay;
+            ++Stats_.SlowBodies;
+        }
+
+        return decision;
+    }
+
+private:
+    const FaultProfile* Find(const std::string& endpoint) const {
+        auto it = Endpoints_.find(endpoint);
+        if (it != Endpoints_.end()) {
+            return &it->second;
+        }
+
+        return Default_ ? &*Default_ : nullptr;
+    }
+
+    bool Roll(double probability) {
+        if (probability <= 0.0) {
+            return false;
+        }
+
+        if (probability >= 1.0) {
+            return true;
+        }
+
+        return std::uniform_real_distribution<double>(0.0, 1.0)(Random_) < probability;
+    }
+
+    std::chrono::microseconds SampleLatency(const LatencyDistribution& latency) {
+        double spread = static_cast<double>(latency.Spread.count());
+        double extra = 0.0;
+
+        if (spread > 0.0) {
+            switch (latency.Kind) {
+                case LatencyDistribution::Type::Constant:
+                    break;
+
+                case LatencyDistribution::Type::Uniform:
+                    extra = std::uniform_real_distribution<double>(0.0, spread)(Random_);
+                    break;
+
+                case LatencyDistribution::Type::Exponential:
+                    extra = std::exponential_distribution<double>(1.0 / spread)(Random_);
+                    break;
+
+                case LatencyDistribution::Type::LogNormal:
+                    extra = std::lognormal_distribution<double>(
+                        std::log(spread), latency.Sigma)(Random_);
+                    break;
+            }
+        }
+
+        return latency.Base + std::chrono::microseconds(static_cast<int64_t>(extra));
+    }
+
+    // Lets fault-free requests skip the mutex
+    std::atomic<bool> Enabled_{false};
+    std::mutex Mutex_;
+    std::optional<FaultProfile> Default_;
+    std::unordered_map<std::string, FaultProfile> Endpoints_;
+    std::unordered_map<std::string, int> BurstLeft_;
+    std::mt19937_64 Random_{42};
+    FaultStats Stats_;
+};
+
+// "/bot123/getUpdates?offset=1" -> "getUpdates"
+std::string GetEndpoint(const std::string& uri) {
+    auto end = uri.find('?');
+    auto path = uri.substr(0, end);
+    return path.substr(path.rfind('/') + 1);
+}
+
+enum class Endpoint {
+    GetMe,
+    GetUpdates,
+    SendMessage,
+    SendSticker,
+    SendDocument,
+    Other,
+    Count
+};
+
+const std::array<std::string, static_cast<size_t>(Endpoint::Count)> EndpointNames = {
+    "getMe",
+    "getUpdates",
+    "sendMessage",
+    "sendSticker",
+    "sendDocument",
+    "other"
+};
+
+Endpoint ParseEndpoint(const std::string& name) {
+    for (size_t i = 0; i + 1 < EndpointNames.size(); ++i) {
+        if (EndpointNames[i] == name) {
+            return static_cast<Endpoint>(i);
+        }
+    }
+
+    return Endpoint::Other;
+}
+
+// Per-endpoint request accounting. Counters are sharded by server
+// thread, so concurrent handlers increment their own cache line and
+// readers sum the shards; processing times go to lock-free histograms.
+// The raw per-request log is opt-in since it takes a mutex.
+class RequestStats {
+public:
+    void SetStartTime(std::chrono::steady_clock::time_point start) {
+        Start_ = start;
+    }
+
+    void SetRecordRequests(bool record) {
+        RecordRequests_ = record;
+    }
+
+    void Record(
+        const std::string& name,
+        const std::string& uri,
+        std::chrono::steady_clock::time_point arrival,
+        std::chrono::steady_clock::time_point finish,
+        int64_t bytesIn,
+        int64_t bytesOut,
+        int status
+    ) {
+        auto endpoint = static_cast<size_t>(ParseEndpoint(name));
+        auto processing = std::chrono::duration_cast<std::chrono::microseconds>(finish - arrival);
+
+        auto& shard = Shards_[ShardIndex()];
+        shard.Counts[endpoint].fetch_add(1, std::memory_order_relaxed);
+        shard.BytesIn[endpoint].fetch_add(bytesIn, std::memory_order_relaxed);
+        shard.BytesOut[endpoint].fetch_add(bytesOut, std::memory_order_relaxed);
+        Processing_[endpoint].Record(processing.count());
+
+        if (RecordRequests_.load(std::memory_order_relaxed)) {
+            RequestRecord record;
+            record.Endpoint = name;
+            record.Uri = uri;
+            record.Arrival = std::chrono::duration_cast<std::chrono::microseconds>(arrival - Start_);
+            record.Processing = processing;
+            record.BytesIn = bytesIn;
+            record.BytesOut = bytesOut;
+            record.Status = status;
+
+            std::lock_guard<std::mutex> guard(LogMutex_);
+            Log_.push_back(std::move(record));
+        }
+    }
+
+    int64_t GetCount(Endpoint endpoint) const {
+        return Sum(&Shard::Counts, endpoint);
+    }
+
+    int64_t GetBytesIn(Endpoint endpoint) const {
+        return Sum(&Shard::BytesIn, endpoint);
+    }
+
+    int64_t GetBytesOut(Endpoint endpoint) const {
+        return Sum(&Shard::BytesOut, endpoint);
+    }
+
+    const Histogram& GetProcessing(Endpoint endpoint) const {
+        return Processing_[static_cast<size_t>(endpoint)];
+    }
+
+    std::vector<RequestRecord> GetLog() {
+        std::lock_guard<std::mutex> guard(LogMutex_);
+        return Log_;
+    }
+
+private:
+    static constexpr size_t ShardCount = 32;
+    static constexpr size_t EndpointCount = static_cast<size_t>(Endpoint::Count);
+
+    using Counters = std::array<std::atomic<int64_t>, EndpointCount>;
+
+    struct alignas(64) Shard {
+        Counters Counts{};
+        Counters BytesIn{};
+        Counters BytesOut{};
+    };
+
+    static size_t ShardIndex() {
+        static std::atomic<size_t> next{0};
+        thread_local size_t index = next.fetch_add(1) % ShardCount;
+        return index;
+    }
+
+    int64_t Sum(Counters Shard::*counters, Endpoint endpoint) const {
+        int64_t total = 0;
+        for (const auto& shard : Shards_) {
+            total += (shard.*counters)[static_cast<size_t>(endpoint)]
+                .load(std::memory_order_relaxed);
+        }
+
+        return total;
+    }
+
+    std::chrono::steady_clock::time_point Start_ = std::chrono::steady_clock::now();
+    std::array<Shard, ShardCount> Shards_;
+    std::array<Histogram, EndpointCount> Processing_;
+
+    std::atomic<bool> RecordRequests_{false};
+    std::mutex LogMutex_;
+    std::vector<RequestRecord> Log_;
+};
+
 class TestCase {
 public:
     virtual void HandleRequest(HTTPServerRequest& request, HTTPServerResponse& response) = 0;
 
+    // Concurrent test cases are called without Mutex held and must keep
+    // their own state thread safe.
+    virtual bool IsConcurrent() const {
+        return false;
+    }
+
     std::mutex Mutex;
 
+    // Bot token expected in request paths
+    std::string Token = "123";
+
     std::vector<std::string> Expectations;
     int Fulfilled = 0;
 
+    std::mutex FailsMutex;
     std::vector<std::string> Fails;
 
     void Fail(const std::string& message) {
-        Fails.push_back(message);
+        {
+            std::lock_guard<std::mutex> guard(FailsMutex);
+            Fails.push_back(message);
+        }
         throw CheckFailedException();
     }
 
+    void Reply(HTTPServerResponse& response, const std::string& plainBody) {
+        std::string compressedBody;
+        if (CompressReply) {
+            compressedBody = GzipBody(plainBody);
+            response.set("Content-Encoding", "gzip");
+        }
+        const std::string& body = CompressReply ? compressedBody : plainBody;
+
+        response.setContentLength(body.size());
+        std::ostream& out = response.send();
+
+        if (!CurrentFault || CurrentFault->SlowBodyChunk == 0) {
+            out << body;
+            return;
+        }
+
+        size_t chunk = CurrentFault->SlowBodyChunk;
+        for (size_t pos = 0; pos < body.size(); pos += chunk) {
+            out.write(body.data() + pos, std::min(chunk, body.size() - pos));
+            out.flush();
+            std::this_thread::sleep_for(CurrentFault->SlowBodyDelay);
+        }
+    }
+
     void ExpectURI(HTTPServerRequest& request, std::string uri) {
         if (request.getURI() != uri) {
             Fail("Invalid URI: expected " + uri + ", got " + request.getURI());
@@ -81,13 +442,13 @@ public:
 
     void HandleRequest(HTTPServerRequest& request, HTTPServerResponse& response) override {
         auto ur = request.getURI();
-        ExpectURI(request, "/bot123/getMe");
+        ExpectURI(request, "/bot" + Token + "/getMe");
         ExpectMethod(request, "GET");
 
         Fulfilled++;
         if (Fulfilled == 1) {
             response.setStatus(HTTPResponse::HTTP_OK);
-            response.send() << FakeData::GetMeJson;
+            Reply(response, FakeData::GetMeJson);
         } else {
             Fail("Unexpected extra request");
         }
@@ -104,16 +465,16 @@ public:
     }
 
     void HandleRequest(HTTPServerRequest& request, HTTPServerResponse& response) override {
-        ExpectURI(request, "/bot123/getMe");
+        ExpectURI(request, "/bot" + Token + "/getMe");
         ExpectMethod(request, "GET");
 
         ++Fulfilled;
         if (Fulfilled == 1) {
             response.setStatus(HTTPResponse::HTTP_INTERNAL_SERVER_ERROR);
-            response.send() << "Internal server error";
+            Reply(response, "Internal server error");
         } else if (Fulfilled == 2) {
             response.setStatus(HTTPResponse::HTTP_UNAUTHORIZED);
-            response.send() << FakeData::GetMeErrorJson;
+            Reply(response, FakeData::GetMeErrorJson);
         } else {
             Fail("Unexpected extra request");
         }
@@ -157,13 +518,13 @@ public:
 
         ++Fulfilled;
         if (Fulfilled == 1) {
-            ExpectURI(request, "/bot123/getUpdates");
+            ExpectURI(request, "/bot" + Token + "/getUpdates");
             ExpectMethod(request, "GET");
 
             response.setStatus(HTTPResponse::HTTP_OK);
-            response.send() << FakeData::GetUpdatesFourMessagesJson;
+            Reply(response, FakeData::GetUpdatesFourMessagesJson);
         } else if (Fulfilled == 2) {
-            ExpectURI(request, "/bot123/sendMessage");
+            ExpectURI(request, "/bot" + Token + "/sendMessage");
             ExpectMethod(request, "POST");
             checkContentType();
             parseJson();
@@ -177,9 +538,9 @@ public:
             }
 
             response.setStatus(HTTPResponse::HTTP_OK);
-            response.send() << FakeData::SendMessageHiJson;
+            Reply(response, FakeData::SendMessageHiJson);
         } else if (Fulfilled == 3 || Fulfilled == 4) {
-            ExpectURI(request, "/bot123/sendMessage");
+            ExpectURI(request, "/bot" + Token + "/sendMessage");
             ExpectMethod(request, "POST");
             checkContentType();
             parseJson();
@@ -197,7 +558,7 @@ public:
             }
 
             response.setStatus(HTTPResponse::HTTP_OK);
-            response.send() << FakeData::SendMessageReplyJson;
+            Reply(response, FakeData::SendMessageReplyJson);
         } else {
             Fail("Unexpected extra request");
         }
@@ -218,66 +579,472 @@ public:
         ++Fulfilled;
 
         if (Fulfilled == 1) {
-            ExpectURI(request, "/bot123/getUpdates?timeout=5");
+            ExpectURI(request, "/bot" + Token + "/getUpdates?timeout=5");
             ExpectMethod(request, "GET");
 
             response.setStatus(HTTPResponse::HTTP_OK);
-            response.send() << FakeData::GetUpdatesTwoMessages;
+            Reply(response, FakeData::GetUpdatesTwoMessages);
         } else if (Fulfilled == 2) {
-            ExpectURI(request, "/bot123/getUpdates?offset=851793508&timeout=5");
+            ExpectURI(request, "/bot" + Token + "/getUpdates?offset=851793508&timeout=5");
             ExpectMethod(request, "GET");
 
             response.setStatus(HTTPResponse::HTTP_OK);
-            response.send() << FakeData::GetUpdatesZeroMessages;
+            Reply(response, FakeData::GetUpdatesZeroMessages);
         } else if (Fulfilled == 3) {
-            ExpectURI(request, "/bot123/getUpdates?offset=851793508&timeout=5");
+            ExpectURI(request, "/bot" + Token + "/getUpdates?offset=851793508&timeout=5");
             ExpectMethod(request, "GET");
 
             response.setStatus(HTTPResponse::HTTP_OK);
-            response.send() << FakeData::GetupdatesOneMessage;
+            Reply(response, FakeData::GetupdatesOneMessage);
         } else {
             Fail("Unexpected extra request");
         }
     }
 };
 
+// Keeps the file part of a multipart form, HTMLForm keeps the fields.
+class UploadPartHandler : public PartHandler {
+public:
+    void handlePart(const MessageHeader& header, std::istream& stream) override {
+        std::string disposition;
+        NameValueCollection parameters;
+        MessageHeader::splitParameters(header.get("Content-Disposition", ""), disposition, parameters);
+
+        Field = parameters.get("name", "");
+        FileName = parameters.get("filename", "");
+        Content.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+    }
+
+    std::string Field;
+    std::string FileName;
+    std::string Content;
+};
+
+// Answers every known endpoint with a canned reply and never fails on
+// request order, so any number of clients can hammer it in parallel.
+// Multipart sendSticker and sendDocument bodies are parsed and kept.
+class LoadTestCase : public TestCase {
+public:
+    bool IsConcurrent() const override {
+        return true;
+    }
+
+    void HandleRequest(HTTPServerRequest& request, HTTPServerResponse& response) override {
+        auto endpoint = ParseEndpoint(GetEndpoint(request.getURI()));
+        if ((endpoint == Endpoint::SendSticker || endpoint == Endpoint::SendDocument) &&
+            request.getContentType().find("multipart/form-data") == 0) {
+            ReceiveUpload(request);
+        }
+
+        // Body must be consumed for the connection to be kept alive
+        request.stream().ignore(std::numeric_limits<std::streamsize>::max());
+
+        auto prefix = "/bot" + Token + "/";
+        if (request.getURI().compare(0, prefix.size(), prefix) != 0) {
+            Fail("Invalid token in " + request.getURI());
+        }
+
+        switch (endpoint) {
+            case Endpoint::GetMe:
+                response.setStatus(HTTPResponse::HTTP_OK);
+                Reply(response, FakeData::GetMeJson);
+                break;
+
+            case Endpoint::GetUpdates:
+                response.setStatus(HTTPResponse::HTTP_OK);
+                Reply(response, FakeData::GetUpdatesZeroMessages);
+                break;
+
+            case Endpoint::SendMessage:
+            case Endpoint::SendSticker:
+            case Endpoint::SendDocument:
+                response.setStatus(HTTPResponse::HTTP_OK);
+                Reply(response, FakeData::SendMessageHiJson);
+                break;
+
+            default:
+                Fail("Unexpected request " + request.getURI());
+        }
+    }
+
+    std::vector<UploadRecord> GetUploads() const {
+        return Uploads_;
+    }
+
+private:
+    void ReceiveUpload(HTTPServerRequest& request) {
+        UploadPartHandler file;
+        HTMLForm form(request, request.stream(), file);
+
+        UploadRecord upload;
+        upload.Endpoint = GetEndpoint(request.getURI());
+        upload.ChatId = form.get("chat_id", "");
+        upload.Field = std::move(file.Field);
+        upload.FileName = std::move(file.FileName);
+        upload.Content = std::move(file.Content);
+
+        std::lock_guard<std::mutex> guard(Mutex);
+        Uploads_.push_back(std::move(upload));
+    }
+
+    std::vector<UploadRecord> Uploads_;
+};
+
+// Broadcast target: sendMessage answers by the last digit of chat_id,
+//  1 - the bot is blocked (403),
+//  2 - chat not found (400),
+//  3 - a group migrated to supergroup -(10^12 + chat_id) (400),
+// and succeeds otherwise. A second message to one chat is a failure.
+class BroadcastTestCase : public TestCase {
+public:
+    bool IsConcurrent() const override {
+        return true;
+    }
+
+    void HandleRequest(HTTPServerRequest& request, HTTPServerResponse& response) override {
+        if (GetEndpoint(request.getURI()) != "sendMessage") {
+            Fail("Unexpected request " + request.getURI());
+        }
+
+        Json::Value message;
+        request.stream() >> message;
+        auto chatId = message["chat_id"].asInt64();
+        {
+            std::lock_guard<std::mutex> guard(Mutex);
+            if (!Delivered_.insert(chatId).second) {
+                Fail("Second message to chat " + std::to_string(chatId));
+            }
+        }
+
+        auto error = [&](int status, const std::string& description, const std::string& parameters = "") {
+            response.setStatus(static_cast<HTTPResponse::HTTPStatus>(status));
+            response.setContentType("application/json");
+            Reply(response, R"({"ok":false,"error_code":)" + std::to_string(status) +
+                            R"(,"description":")" + description + "\"" + parameters + "}");
+        };
+
+        switch (chatId > 0 ? chatId % 10 : 0) {
+            case 1:
+                error(403, "Forbidden: bot was blocked by the user");
+                break;
+
+            case 2:
+                error(400, "Bad Request: chat not found");
+                break;
+
+            case 3:
+                error(400, "Bad Request: group chat was upgraded to a supergroup chat",
+                      R"(,"parameters":{"migrate_to_chat_id":)" +
+                      std::to_string(-(1000000000000 + chatId)) + "}");
+                break;
+
+            default:
+                response.setStatus(HTTPResponse::HTTP_OK);
+                Reply(response, FakeData::SendMessageHiJson);
+        }
+    }
+
+private:
+    std::set<int64_t> Delivered_;
+};
+
+// Bot-vs-fake benchmark: serves LoadScenario batches to getUpdates,
+// then a single "/stop" message, and measures time from a batch being
+// served to the reply for each of its updates.
+class LoadScenarioTestCase : public TestCase {
+public:
+    LoadScenarioTestCase(const LoadScenario& scenario)
+        : Scenario_(scenario)
+    {
+        Expectations = {
+            "Client receives all batches",
+            "Client replies to every update"
+        };
+
+        if (Scenario_.Mix.empty()) {
+            throw std::runtime_error("Load scenario has empty mix");
+        }
+
+        std::vector<double> weights;
+        for (const auto& item : Scenario_.Mix) {
+            weights.push_back(item.second);
+        }
+
+        std::mt19937 random(Scenario_.Seed);
+        std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+
+        Total_ = Scenario_.Batches * Scenario_.BatchSize;
+        for (size_t batch = 0; batch < Scenario_.Batches; ++batch) {
+            std::vector<std::string> texts;
+            for (size_t i = 0; i < Scenario_.BatchSize; ++i) {
+                texts.push_back(Scenario_.Mix[pick(random)].first);
+            }
+
+            auto first = batch * Scenario_.BatchSize;
+            Batches_.push_back(FakeData::GenerateUpdatesJson(
+                Scenario_.BatchSize, FirstUpdateId + first, FirstChatId + first, texts));
+        }
+
+        Stop_ = FakeData::GenerateUpdatesJson(1, FirstUpdateId + Total_, FirstChatId + Total_, {"/stop"});
+        Served_.resize(Total_);
+        Replied_.resize(Total_, false);
+    }
+
+    void HandleRequest(HTTPServerRequest& request, HTTPServerResponse& response) override {
+        switch (ParseEndpoint(GetEndpoint(request.getURI()))) {
+            case Endpoint::GetMe:
+                response.setStatus(HTTPResponse::HTTP_OK);
+                Reply(response, FakeData::GetMeJson);
+                break;
+
+            case Endpoint::GetUpdates:
+                ServeBatch(response);
+                break;
+
+            case Endpoint::SendMessage:
+            case Endpoint::SendSticker:
+            case Endpoint::SendDocument:
+                AcceptReply(request, response);
+                break;
+
+            default:
+                Fail("Unexpected request " + request.getURI());
+        }
+    }
+
+    LoadResult GetResult() {
+        LoadResult result;
+        result.UpdatesServed = std::min(NextBatch_ * Scenario_.BatchSize, Total_);
+        result.Replies = Replies_;
+        result.ReplyLatency = ReplyLatency_;
+        if (Replies_ > 0) {
+            result.Duration = std::chrono::duration_cast<std::chrono::microseconds>(
+                LastReply_ - FirstServed_);
+        }
+
+        return result;
+    }
+
+private:
+    static constexpr int32_t FirstUpdateId = 1;
+    static constexpr int64_t FirstChatId = 1000000;
+
+    void ServeBatch(HTTPServerResponse& response) {
+        response.setStatus(HTTPResponse::HTTP_OK);
+
+        if (NextBatch_ < Batches_.size()) {
+            Reply(response, Batches_[NextBatch_]);
+
+            auto now = std::chrono::steady_clock::now();
+            if (NextBatch_ == 0) {
+                FirstServed_ = now;
+            }
+
+            auto first = NextBatch_ * Scenario_.BatchSize;
+            std::fill(Served_.begin() + first, Served_.begin() + first + Scenario_.BatchSize, now);
+            ++NextBatch_;
+        } else if (!StopServed_) {
+            Reply(response, Stop_);
+            StopServed_ = true;
+            ++Fulfilled;
+        } else {
+            Reply(response, FakeData::GetUpdatesZeroMessages);
+        }
+    }
+
+    void AcceptReply(HTTPServerRequest& request, HTTPServerResponse& response) {
+        auto now = std::chrono::steady_clock::now();
+
+        Json::Value message;
+        request.stream() >> message;
+
+        auto index = message["chat_id"].asInt64() - FirstChatId;
+        if (index < 0 || static_cast<size_t>(index) >= Total_) {
+            Fail("Reply to unknown chat " + message["chat_id"].asString());
+        }
+
+        if (Replied_[index]) {
+            Fail("Second reply to chat " + message["chat_id"].asString());
+        }
+
+        Replied_[index] = true;
+        ReplyLatency_.Record(std::chrono::duration_cast<std::chrono::microseconds>(
+            now - Served_[index]).count());
+        LastReply_ = now;
+
+        if (++Replies_ == static_cast<int64_t>(Total_)) {
+            ++Fulfilled;
+        }
+
+        response.setStatus(HTTPResponse::HTTP_OK);
+        Reply(response, FakeData::SendMessageHiJson);
+    }
+
+    LoadScenario Scenario_;
+    size_t Total_ = 0;
+    std::vector<std::string> Batches_;
+    std::string Stop_;
+
+    size_t NextBatch_ = 0;
+    bool StopServed_ = false;
+    std::vector<std::chrono::steady_clock::time_point> Served_;
+    std::vector<bool> Replied_;
+    int64_t Replies_ = 0;
+    Histogram ReplyLatency_;
+    std::chrono::steady_clock::time_point FirstServed_;
+    std::chrono::steady_clock::time_point LastReply_;
+};
+
 class FakeHandler : public HTTPRequestHandler {
 public:
-    FakeHandler(TestCase *testCase) : TestCase_(testCase) {}
+    FakeHandler(TestCase *testCase, FaultInjector *faults, RequestStats *stats, bool compression)
+        : TestCase_(testCase)
+        , Faults_(faults)
+        , Stats_(stats)
+        , Compression_(compression)
+    {}
 
     virtual void handleRequest(HTTPServerRequest& request, HTTPServerResponse& response) override {
-        std::unique_lock<std::mutex> guard(TestCase_->Mutex);
+        auto arrival = std::chrono::steady_clock::now();
+        auto endpoint = GetEndpoint(request.getURI());
+
+        bool responded = true;
+        try {
+            responded = Handle(request, response, endpoint);
+        } catch (...) {
+            Record(request, response, endpoint, arrival, responded);
+            throw;
+        }
+        Record(request, response, endpoint, arrival, responded);
+    }
+
+private:
+    // False if the connection was reset without a response
+    bool Handle(HTTPServerRequest& request, HTTPServerResponse& response, const std::string& endpoint) {
+        auto fault = Faults_->Decide(endpoint);
+        if (fault.Latency.count() > 0) {
+            std::this_thread::sleep_for(fault.Latency);
+        }
+
+        if (fault.Reset) {
+            ResetConnection(request);
+            return false;
+        }
+
+        if (fault.Status == HTTPResponse::HTTP_TOO_MANY_REQUESTS) {
+            SendTooManyRequests(response, fault.RetryAfter);
+            return true;
+        }
+
+        if (fault.Status != 0) {
+            SendServerError(response, fault.Status);
+            return true;
+        }
+
+        std::unique_lock<std::mutex> guard(TestCase_->Mutex, std::defer_lock);
+        if (!TestCase_->IsConcurrent()) {
+            guard.lock();
+        }
+
+        CurrentFault = &fault;
+        CompressReply = Compression_ &&
+            request.get("Accept-Encoding", "").find("gzip") != std::string::npos;
         try {
             TestCase_->HandleRequest(request, response);
         } catch (const CheckFailedException& e) {
             response.setStatus(HTTPResponse::HTTP_BAD_REQUEST);
             response.send();
         } catch (const std::exception& e) {
+            CurrentFault = nullptr;
+            CompressReply = false;
             TestCase_->Fail(e.what());
             throw;
         }
+        CurrentFault = nullptr;
+        CompressReply = false;
+        return true;
+    }
+
+    void Record(
+        HTTPServerRequest& request,
+        HTTPServerResponse& response,
+        const std::string& endpoint,
+        std::chrono::steady_clock::time_point arrival,
+        bool responded
+    ) {
+        Stats_->Record(
+            endpoint,
+            request.getURI(),
+            arrival,
+            std::chrono::steady_clock::now(),
+            request.hasContentLength() ? request.getContentLength64() : 0,
+            responded && response.hasContentLength() ? response.getContentLength64() : 0,
+            responded ? response.getStatus() : 0);
+    }
+
+    void ResetConnection(HTTPServerRequest& request) {
+        // Zero linger turns close() into RST instead of FIN
+        auto& socket = static_cast<HTTPServerRequestImpl&>(request).socket();
+        socket.setLinger(true, 0);
+        socket.close();
+    }
+
+    void SendTooManyRequests(HTTPServerResponse& response, int retryAfter) {
+        auto seconds = std::to_string(retryAfter);
+        std::string body =
+            R"({"ok":false,"error_code":429,"description":"Too Many Requests: retry after )" +
+            seconds + R"(","parameters":{"retry_after":)" + seconds + "}}";
+
+        response.setStatus(HTTPResponse::HTTP_TOO_MANY_REQUESTS);
+        response.set("Retry-After", seconds);
+        response.setContentType("application/json");
+        response.setContentLength(body.size());
+        response.send() << body;
+    }
+
+    void SendServerError(HTTPServerResponse& response, int status) {
+        auto httpStatus = static_cast<HTTPResponse::HTTPStatus>(status);
+        const auto& body = HTTPResponse::getReasonForStatus(httpStatus);
+
+        response.setStatus(httpStatus);
+        response.setContentLength(body.size());
+        response.send() << body;
     }
 
-private:
     TestCase *TestCase_;
+    FaultInjector *Faults_;
+    RequestStats *Stats_;
+    bool Compression_;
 };
 
 
 class FakeHandlerFactory : public HTTPRequestHandlerFactory {
 public:
-    FakeHandlerFactory(TestCase *testCase) : TestCase_(testCase) {}
+    FakeHandlerFactory(TestCase *testCase, FaultInjector *faults, RequestStats *stats, bool compression)
+        : TestCase_(testCase)
+        , Faults_(faults)
+        , Stats_(stats)
+        , Compression_(compression)
+    {}
 
     virtual HTTPRequestHandler *createRequestHandler(
         const HTTPServerRequest&
     ) {
-        return new FakeHandler(TestCase_);
+        return new FakeHandler(TestCase_, Faults_, Stats_, Compression_);
     }
 
 private:
     TestCase *TestCase_;
+    FaultInjector *Faults_;
+    RequestStats *Stats_;
+    bool Compression_;
 };
 
-FakeServer::FakeServer(const std::string& testCase) {
+FakeServer::FakeServer(const std::string& testCase, uint16_t port)
+    : Port_(port)
+    , Faults_(std::make_shared<FaultInjector>())
+    , Stats_(std::make_shared<RequestStats>())
+{
     if (testCase == "Single getMe") {
         TestCase_.reset(new SingleGetMeTestCase());
     } else if (testCase == "getMe error handling") {
@@ -286,28 +1053,212 @@ FakeServer::FakeServer(const std::string& testCase) {
         TestCase_.reset(new GetUpdatesAndSendMessagesTestCase());
     } else if (testCase == "Handle getUpdates offset") {
         TestCase_.reset(new HandleOffsetTestCase());
+    } else if (testCase == "Load") {
+        TestCase_.reset(new LoadTestCase());
+    } else if (testCase == "Broadcast") {
+        TestCase_.reset(new BroadcastTestCase());
     } else {
         throw std::runtime_error("Unknown test case name " + testCase);
     }
 }
 
+FakeServer::FakeServer(const LoadScenario& scenario, uint16_t port)
+    : Port_(port)
+    , Faults_(std::make_shared<FaultInjector>())
+    , Stats_(std::make_shared<RequestStats>())
+{
+    TestCase_.reset(new LoadScenarioTestCase(scenario));
+}
+
 FakeServer::~FakeServer() {
     Stop();
 }
 
 void FakeServer::Start() {
-    Socket_.reset(new ServerSocket(SocketAddress("localhost", 8080)));
+    Socket_.reset(new ServerSocket(SocketAddress("localhost", Port_)));
+    Port_ = Socket_->address().port();
+    Stats_->SetStartTime(std::chrono::steady_clock::now());
+
+    HTTPServerParams::Ptr params = new HTTPServerParams();
+    params->setMaxThreads(Params_.MaxThreads);
+    params->setMaxQueued(Params_.MaxQueued);
+    params->setKeepAlive(Params_.KeepAlive);
+    params->setMaxKeepAliveRequests(Params_.MaxKeepAliveRequests);
+
+    // Default pool is capped at 16 threads, so the server gets its own
+    Pool_.reset(new ThreadPool(2, std::max(2, Params_.MaxThreads)));
 
     Server_.reset(new HTTPServer(
-        new FakeHandlerFactory(TestCase_.get()),
+        new FakeHandlerFactory(TestCase_.get(), Faults_.get(), Stats_.get(), Params_.Compression),
+        *Pool_,
         *Socket_,
-        new HTTPServerParams()));
+        params));
 
     Server_->start();
 }
 
 std::string FakeServer::GetUrl() {
-    return "http://localhost:" + std::to_string(8080) + "/";
+    return "http://localhost:" + std::to_string(Port_) + "/";
+}
+
+uint16_t FakeServer::GetPort() const {
+    return Port_;
+}
+
+void FakeServer::SetToken(const std::string& token) {
+    TestCase_->Token = token;
+}
+
+const std::string& FakeServer::GetToken() const {
+    return TestCase_->Token;
+}
+
+void FakeServer::SetParams(const FakeServerParams& params) {
+    Params_ = params;
+}
+
+std::map<std::string, int64_t> FakeServer::GetRequestCounts() {
+    std::map<std::string, int64_t> counts;
+    for (size_t i = 0; i < EndpointNames.size(); ++i) {
+        auto count = Stats_->GetCount(static_cast<Endpoint>(i));
+        if (count > 0) {
+            counts[EndpointNames[i]] = count;
+        }
+    }
+
+    return counts;
+}
+
+FakeServerStats FakeServer::GetStats() {
+    FakeServerStats stats;
+    for (size_t i = 0; i < EndpointNames.size(); ++i) {
+        auto endpoint = static_cast<Endpoint>(i);
+        if (Stats_->GetCount(endpoint) > 0) {
+            stats.Requests[EndpointNames[i]] = Stats_->GetCount(endpoint);
+            stats.BytesIn[EndpointNames[i]] = Stats_->GetBytesIn(endpoint);
+            stats.BytesOut[EndpointNames[i]] = Stats_->GetBytesOut(endpoint);
+        }
+    }
+
+    if (Server_) {
+        stats.Connections = Server_->totalConnections();
+    }
+    stats.Faults = GetFaultStats();
+    return stats;
+}
+
+void FakeServer::SetRecordRequests(bool record) {
+    Stats_->SetRecordRequests(record);
+}
+
+std::vector<RequestRecord> FakeServer::GetRequestLog() {
+    return Stats_->GetLog();
+}
+
+Histogram FakeServer::GetProcessingHistogram(const std::string& endpoint) {
+    return Stats_->GetProcessing(ParseEndpoint(endpoint));
+}
+
+Json::Value HistogramToJson(const Histogram& histogram) {
+    Json::Value json;
+    json["count"] = Json::Int64(histogram.Count());
+    json["min"] = Json::Int64(histogram.Min());
+    json["mean"] = histogram.Mean();
+    json["p50"] = Json::Int64(histogram.Percentile(50));
+    json["p90"] = Json::Int64(histogram.Percentile(90));
+    json["p99"] = Json::Int64(histogram.Percentile(99));
+    json["p999"] = Json::Int64(histogram.Percentile(99.9));
+    json["max"] = Json::Int64(histogram.Max());
+
+    json["buckets"] = Json::Value(Json::arrayValue);
+    for (const auto& bucket : histogram.Buckets()) {
+        Json::Value pair(Json::arrayValue);
+        pair.append(Json::Int64(bucket.upper_bound));
+        pair.append(Json::Int64(bucket.count));
+        json["buckets"].append(pair);
+    }
+
+    return json;
+}
+
+std::string FakeServer::DumpStatsJson() {
+    Json::Value json;
+    json["url"] = GetUrl();
+    json["token"] = GetToken();
+
+    auto stats = GetStats();
+    json["endpoints"] = Json::Value(Json::objectValue);
+    for (const auto& [name, count] : stats.Requests) {
+        Json::Value endpoint;
+        endpoint["count"] = Json::Int64(count);
+        endpoint["bytes_in"] = Json::Int64(stats.BytesIn[name]);
+        endpoint["bytes_out"] = Json::Int64(stats.BytesOut[name]);
+        endpoint["processing_us"] = HistogramToJson(GetProcessingHistogram(name));
+        json["endpoints"][name] = endpoint;
+    }
+
+    json["faults"]["delayed"] = Json::Int64(stats.Faults.Delayed);
+    json["faults"]["slow_bodies"] = Json::Int64(stats.Faults.SlowBodies);
+    json["faults"]["resets"] = Json::Int64(stats.Faults.Resets);
+    json["faults"]["server_errors"] = Json::Int64(stats.Faults.ServerErrors);
+    json["faults"]["too_many_requests"] = Json::Int64(stats.Faults.TooManyRequests);
+
+    json["requests"] = Json::Value(Json::arrayValue);
+    for (const auto& record : GetRequestLog()) {
+        Json::Value request;
+        request["endpoint"] = record.Endpoint;
+        request["uri"] = record.Uri;
+        request["arrival_us"] = Json::Int64(record.Arrival.count());
+        request["processing_us"] = Json::Int64(record.Processing.count());
+        request["bytes_in"] = Json::Int64(record.BytesIn);
+        request["bytes_out"] = Json::Int64(record.BytesOut);
+        request["status"] = record.Status;
+        json["requests"].append(request);
+    }
+
+    Json::StreamWriterBuilder builder;
+    builder["indentation"] = "  ";
+    return Json::writeString(builder, json);
+}
+
+LoadResult FakeServer::GetLoadResult() {
+    auto scenario = std::dynamic_pointer_cast<LoadScenarioTestCase>(TestCase_);
+    if (!scenario) {
+        throw std::runtime_error("Fake server is not running a load scenario");
+    }
+
+    std::lock_guard<std::mutex> guard(TestCase_->Mutex);
+    return scenario->GetResult();
+}
+
+std::vector<UploadRecord> FakeServer::GetUploads() {
+    auto load = std::dynamic_pointer_cast<LoadTestCase>(TestCase_);
+    if (!load) {
+        throw std::runtime_error("Fake server is not running the Load test case");
+    }
+
+    std::lock_guard<std::mutex> guard(TestCase_->Mutex);
+    return load->GetUploads();
+}
+
+void FakeServer::SetFaults(const FaultProfile& faults) {
+    Faults_->SetDefault(faults);
+}
+
+void FakeServer::SetFaults(const std::string& endpoint, const FaultProfile& faults) {
+    Faults_->Set(endpoint, faults);
+}
+
+void FakeServer::ClearFaults() {
+    Faults_->Clear();
+}
+
+void FakeServer::SetFaultSeed(uint64_t seed) {
+    Faults_->Seed(seed);
+}
+
+FaultStats FakeServer::GetFaultStats() {
+    return Faults_->GetStats();
 }
 
 void FakeServer::Stop() {
@@ -316,6 +1267,7 @@ void FakeServer::Stop() {
 
         Server_.reset();
         Socket_.reset();
+        Pool_.reset();
     }
 }
 
@@ -325,4 +1277,77 @@ void FakeServer::StopAndCheckExpectations() {
     TestCase_->Check();
 }
 
+FakeCluster::FakeCluster(const std::string& testCase, const std::vector<std::string>& tokens) {
+    for (const auto& token : tokens) {
+        Servers_.push_back(std::make_unique<FakeServer>(testCase, 0));
+        Servers_.back()->SetToken(token);
+    }
+}
+
+void FakeCluster::Start() {
+    for (auto& server : Servers_) {
+        server->Start();
+    }
+}
+
+size_t FakeCluster::Size() const {
+    return Servers_.size();
+}
+
+FakeServer& FakeCluster::operator[](size_t index) {
+    return *Servers_.at(index);
+}
+
+FakeServerStats FakeCluster::GetStats() {
+    FakeServerStats total;
+    for (auto& server : Servers_) {
+        auto stats = server->GetStats();
+        for (const auto& [endpoint, count] : stats.Requests) {
+            total.Requests[endpoint] += count;
+            total.BytesIn[endpoint] += stats.BytesIn[endpoint];
+            total.BytesOut[endpoint] += stats.BytesOut[endpoint];
+        }
+
+        total.Connections += stats.Connections;
+        total.Faults.Delayed += stats.Faults.Delayed;
+        total.Faults.SlowBodies += stats.Faults.SlowBodies;
+        total.Faults.Resets += stats.Faults.Resets;
+        total.Faults.ServerErrors += stats.Faults.ServerErrors;
+        total.Faults.TooManyRequests += stats.Faults.TooManyRequests;
+    }
+
+    return total;
+}
+
+Histogram FakeCluster::GetProcessingHistogram(const std::string& endpoint) {
+    Histogram total;
+    for (auto& server : Servers_) {
+        total.Merge(server->GetProcessingHistogram(endpoint));
+    }
+
+    return total;
+}
+
+void FakeCluster::Stop() {
+    for (auto& server : Servers_) {
+        server->Stop();
+    }
+}
+
+void FakeCluster::StopAndCheckExpectations() {
+    std::stringstream errors;
+    for (size_t i = 0; i < Servers_.size(); ++i) {
+        try {
+            Servers_[i]->StopAndCheckExpectations();
+        } catch (const std::runtime_error& e) {
+            errors << "Server #" << i << " (token " << Servers_[i]->GetToken()
+                   << "):" << std::endl << e.what();
+        }
+    }
+
+    if (!errors.str().empty()) {
+        throw std::runtime_error(errors.str());
+    }
+}
+
 } // namespace telegram
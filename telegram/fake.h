@@ -1,18 +1,152 @@
 #pragma once
 
+#include <chrono>
+#include <map>
 #include <string>
 #include <memory>
+#include <utility>
+#include <vector>
 
+#include "histogram.h"
+
+#include <Poco/ThreadPool.h>
 #include <Poco/Net/HTTPServer.h>
 #include <Poco/Net/ServerSocket.h>
 
 namespace telegram {
 
 class TestCase;
+class FaultInjector;
+class RequestStats;
+
+// Server tuning, applied on Start().
+struct FakeServerParams {
+    int MaxThreads = 16;
+    int MaxQueued = 64;
+    bool KeepAlive = true;
+    // 0 means no limit
+    int MaxKeepAliveRequests = 0;
+    // Gzip replies to requests with "Accept-Encoding: gzip"
+    bool Compression = false;
+};
+
+// Delay added before a request is handled.
+//  Constant:    Base
+//  Uniform:     Base + U(0, Spread)
+//  Exponential: Base + Exp(mean = Spread)
+//  LogNormal:   Base + LogNormal(median = Spread, sigma = Sigma)
+struct LatencyDistribution {
+    enum class Type {
+        Constant,
+        Uniform,
+        Exponential,
+        LogNormal
+    };
+
+    Type Kind = Type::Constant;
+    std::chrono::microseconds Base{0};
+    std::chrono::microseconds Spread{0};
+    double Sigma = 1.0;
+};
+
+// Faults injected into requests of one endpoint (or of all endpoints).
+// Probabilities are checked independently for every request.
+struct FaultProfile {
+    LatencyDistribution Latency;
+
+    // Response body is written by SlowBodyChunk bytes with SlowBodyDelay
+    // pause after every chunk. Zero chunk size disables slow writes.
+    size_t SlowBodyChunk = 0;
+    std::chrono::microseconds SlowBodyDelay{0};
+
+    // Connection is reset (RST) without any response.
+    double ResetProbability = 0.0;
+
+    // With ServerErrorBurstProbability a burst starts and the next
+    // ServerErrorBurstLength requests get ServerErrorStatus.
+    double ServerErrorBurstProbability = 0.0;
+    int ServerErrorBurstLength = 1;
+    int ServerErrorStatus = 500;
+
+    // Request is answered with 429 and parameters.retry_after = RetryAfter.
+    double TooManyRequestsProbability = 0.0;
+    int RetryAfter = 1;
+};
+
+struct FaultStats {
+    int64_t Delayed = 0;
+    int64_t SlowBodies = 0;
+    int64_t Resets = 0;
+    int64_t ServerErrors = 0;
+    int64_t TooManyRequests = 0;
+};
+
+struct FakeServerStats {
+    std::map<std::string, int64_t> Requests;
+    std::map<std::string, int64_t> BytesIn;
+    std::map<std::string, int64_t> BytesOut;
+    // TCP connections accepted since Start().
+    int64_t Connections = 0;
+    FaultStats Faults;
+};
+
+// One handled request. Arrival is counted from FakeServer::Start(),
+// processing covers injected latency and slow body writes. Bytes are
+// Content-Length of request and response bodies.
+struct RequestRecord {
+    std::string Endpoint;
+    std::string Uri;
+    std::chrono::microseconds Arrival{0};
+    std::chrono::microseconds Processing{0};
+    int64_t BytesIn = 0;
+    int64_t BytesOut = 0;
+    // 0 for a connection reset without a response
+    int Status = 0;
+};
+
+// multipart/form-data upload received by the "Load" test case.
+struct UploadRecord {
+    std::string Endpoint;
+    std::string ChatId;
+    // Form field of the file part, e.g. "document"
+    std::string Field;
+    std::string FileName;
+    std::string Content;
+};
+
+// Synthetic traffic for bot-vs-fake benchmarks: getUpdates gets Batches
+// batches of BatchSize private messages, each in its own chat, with
+// texts drawn from Mix by weight. A final "/stop" message ends Bot::Run.
+struct LoadScenario {
+    size_t Batches = 100;
+    size_t BatchSize = 100;
+    std::vector<std::pair<std::string, double>> Mix = {
+        {"/random", 1},
+        {"/weather", 1},
+        {"/styleguide", 1},
+        {"/sticker", 1},
+        {"/gif", 1},
+        {"Hello", 1}
+    };
+    uint32_t Seed = 42;
+};
+
+// Reply latency runs from the batch being served to the reply for the
+// update arriving, in microseconds. Duration runs from the first batch
+// served to the last reply.
+struct LoadResult {
+    int64_t UpdatesServed = 0;
+    int64_t Replies = 0;
+    Histogram ReplyLatency;
+    std::chrono::microseconds Duration{0};
+};
 
 class FakeServer {
 public:
-    FakeServer(const std::string& testCase);
+    // Port 0 binds an ephemeral port, GetUrl() reports the actual one.
+    FakeServer(const std::string& testCase, uint16_t port = 8080);
+
+    FakeServer(const LoadScenario& scenario, uint16_t port = 0);
 
     ~FakeServer();
 
@@ -20,14 +154,88 @@ public:
 
     std::string GetUrl();
 
+    uint16_t GetPort() const;
+
+    // Bot token the test case expects in request paths, "123" by default.
+    void SetToken(const std::string& token);
+
+    const std::string& GetToken() const;
+
+    void SetParams(const FakeServerParams& params);
+
+    // Requests received per endpoint, including ones answered by injected faults.
+    std::map<std::string, int64_t> GetRequestCounts();
+
+    // Faults for all endpoints without their own profile.
+    void SetFaults(const FaultProfile& faults);
+
+    // Faults for one endpoint, e.g. "getUpdates" or "sendMessage".
+    void SetFaults(const std::string& endpoint, const FaultProfile& faults);
+
+    void ClearFaults();
+
+    void SetFaultSeed(uint64_t seed);
+
+    FaultStats GetFaultStats();
+
+    FakeServerStats GetStats();
+
+    // Keep a RequestRecord for every request, off by default.
+    void SetRecordRequests(bool record);
+
+    std::vector<RequestRecord> GetRequestLog();
+
+    // Request processing times of one endpoint in microseconds.
+    Histogram GetProcessingHistogram(const std::string& endpoint);
+
+    // Only for servers running a LoadScenario.
+    LoadResult GetLoadResult();
+
+    // Uploads in arrival order, only for the "Load" test case.
+    std::vector<UploadRecord> GetUploads();
+
+    // Per-endpoint counters and histograms, fault counters and the
+    // request log as a JSON document.
+    std::string DumpStatsJson();
+
     void Stop();
 
     void StopAndCheckExpectations();
 
 private:
+    uint16_t Port_;
     std::shared_ptr<TestCase> TestCase_;
+    std::shared_ptr<FaultInjector> Faults_;
+    std::shared_ptr<RequestStats> Stats_;
+    FakeServerParams Params_;
+    std::unique_ptr<Poco::ThreadPool> Pool_;
     std::unique_ptr<Poco::Net::ServerSocket> Socket_;
     std::unique_ptr<Poco::Net::HTTPServer> Server_;
 };
 
-} // namespace telegram
\ No newline at end of file
+// Several fakes of one test case on ephemeral ports, one per bot token,
+// e.g. to emulate separate bots or shards in a single process.
+class FakeCluster {
+public:
+    FakeCluster(const std::string& testCase, const std::vector<std::string>& tokens);
+
+    void Start();
+
+    size_t Size() const;
+
+    FakeServer& operator[](size_t index);
+
+    // Sum of all servers' stats
+    FakeServerStats GetStats();
+
+    Histogram GetProcessingHistogram(const std::string& endpoint);
+
+    void Stop();
+
+    void StopAndCheckExpectations();
+
+private:
+    std::vector<std::unique_ptr<FakeServer>> Servers_;
+};
+
+} // namespace telegram
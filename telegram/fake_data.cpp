@@ -1,5 +1,7 @@
 #include "fake_data.h"
 
+#include <sstream>
+
 std::string FakeData::GetMeJson = R"(
 {
    "ok" : true,
@@ -298,3 +300,74 @@ std::string FakeData::GetupdatesOneMessage = R"(
    ],
    "ok" : true
 })" + 1;
+
+namespace {
+
+std::string EscapeJson(const std::string& text) {
+    std::string escaped;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            escaped += '\\';
+        }
+        escaped += c;
+    }
+    return escaped;
+}
+
+void WriteUser(std::ostream& out, int64_t id) {
+    out << R"({"id":)" << id
+        << R"(,"is_bot":false,"first_name":"User )" << id
+        << R"(","username":"user_)" << id << R"(","language_code":"en-US"})";
+}
+
+void WriteMessage(std::ostream& out, int32_t messageId, int64_t chatId, const std::string& text) {
+    out << R"({"message_id":)" << messageId << R"(,"from":)";
+    WriteUser(out, chatId);
+    out << R"(,"chat":{"id":)" << chatId
+        << R"(,"type":"private","first_name":"User )" << chatId
+        << R"(","username":"user_)" << chatId << R"("})"
+        << R"(,"date":)" << 1510493105 + messageId
+        << R"(,"text":")" << EscapeJson(text) << '"';
+
+    if (!text.empty() && text[0] == '/') {
+        out << R"(,"entities":[{"offset":0,"length":)" << text.size()
+            << R"(,"type":"bot_command"}])";
+    }
+}
+
+} // namespace
+
+std::string FakeData::GenerateUpdatesJson(
+    size_t count,
+    int32_t firstUpdateId,
+    int64_t firstChatId,
+    const std::vector<std::string>& texts
+) {
+    std::ostringstream out;
+    out << R"({"ok":true,"result":[)";
+
+    for (size_t i = 0; i < count; ++i) {
+        auto chatId = firstChatId + static_cast<int64_t>(i);
+        auto messageId = static_cast<int32_t>(i + 1);
+        const auto& text = texts[i % texts.size()];
+
+        if (i > 0) {
+            out << ',';
+        }
+
+        out << R"({"update_id":)" << firstUpdateId + static_cast<int32_t>(i)
+            << R"(,"message":)";
+        WriteMessage(out, messageId, chatId, text);
+
+        if (i % 4 == 3) {
+            out << R"(,"reply_to_message":)";
+            WriteMessage(out, messageId - 1, chatId, texts[(i - 1) % texts.size()]);
+            out << '}';
+        }
+
+        out << "}}";
+    }
+
+    out << "]}";
+    return out.str();
+}
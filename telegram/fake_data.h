@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 struct FakeData {
     static std::string GetMeJson;
@@ -14,4 +16,15 @@ struct FakeData {
     static std::string GetUpdatesTwoMessages;
     static std::string GetUpdatesZeroMessages;
     static std::string GetupdatesOneMessage;
+
+    // Compact getUpdates response with `count` private messages. Update ids
+    // start at `firstUpdateId`, message i goes to chat `firstChatId + i`
+    // and has text `texts[i % texts.size()]`; every fourth one also
+    // carries a reply_to_message.
+    static std::string GenerateUpdatesJson(
+        size_t count,
+        int32_t firstUpdateId = 851793506,
+        int64_t firstChatId = 104519755,
+        const std::vector<std::string>& texts = {
+            "/random", "/weather", "/styleguide", "/sticker", "/gif", "Hello"});
 };
\ No newline at end of file
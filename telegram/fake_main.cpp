@@ -1,14 +1,16 @@
 #include <iostream>
+#include <string>
 
 #include <telegram/fake.h>
 
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "usage: " << argv[0] << " <test-case>" << std::endl;
+    if (argc != 2 && argc != 3) {
+        std::cerr << "usage: " << argv[0] << " <test-case> [port]" << std::endl;
         return 1;
     }
 
-    telegram::FakeServer fake(argv[1]);
+    uint16_t port = argc == 3 ? std::stoi(argv[2]) : 8080;
+    telegram::FakeServer fake(argv[1], port);
     fake.Start();
 
     std::cout << "Fake server is listening at " << fake.GetUrl() << std::endl;
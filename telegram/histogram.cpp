@@ -0,0 +1,179 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+Histogram::
+Histogram(
+        const Histogram& other
+) {
+    Merge(other);
+}
+
+Histogram&
+Histogram::
+operator=(
+        const Histogram& other
+) {
+    if (this != &other) {
+        Reset();
+        Merge(other);
+    }
+
+    return *this;
+}
+
+size_t
+Histogram::
+BucketIndex(
+        int64_t value
+) {
+    if (value < kSubBucketCount) {
+        return static_cast<size_t>(value);
+    }
+
+    int msb = 63 - __builtin_clzll(static_cast<uint64_t>(value));
+    int shift = msb - kSubBucketBits + 1;
+    return static_cast<size_t>(shift * kSubBucketHalf + (value >> shift));
+}
+
+int64_t
+Histogram::
+BucketUpperBound(
+        size_t index
+) {
+    auto i = static_cast<int64_t>(index);
+    if (i < kSubBucketCount) {
+        return i;
+    }
+
+    int64_t shift = i / kSubBucketHalf - 1;
+    int64_t lower = (i - shift * kSubBucketHalf) << shift;
+    return lower + (int64_t{1} << shift) - 1;
+}
+
+void
+Histogram::
+Record(
+        int64_t value
+) {
+    value = std::max<int64_t>(value, 0);
+
+    counts_[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+
+    int64_t min = min_.load(std::memory_order_relaxed);
+    while (value < min && !min_.compare_exchange_weak(min, value, std::memory_order_relaxed)) {}
+
+    int64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max && !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+}
+
+void
+Histogram::
+Merge(
+        const Histogram& other
+) {
+    for (size_t i = 0; i < kBucketCount; ++i) {
+        auto count = other.counts_[i].load(std::memory_order_relaxed);
+        if (count != 0) {
+            counts_[i].fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+
+    count_.fetch_add(other.Count(), std::memory_order_relaxed);
+    sum_.fetch_add(other.Sum(), std::memory_order_relaxed);
+
+    int64_t other_min = other.min_.load(std::memory_order_relaxed);
+    int64_t min = min_.load(std::memory_order_relaxed);
+    while (other_min < min && !min_.compare_exchange_weak(min, other_min, std::memory_order_relaxed)) {}
+
+    int64_t other_max = other.max_.load(std::memory_order_relaxed);
+    int64_t max = max_.load(std::memory_order_relaxed);
+    while (other_max > max && !max_.compare_exchange_weak(max, other_max, std::memory_order_relaxed)) {}
+}
+
+void
+Histogram::
+Reset() {
+    for (auto& count : counts_) {
+        count.store(0, std::memory_order_relaxed);
+    }
+
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    min_.store(INT64_MAX, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+int64_t
+Histogram::
+Count() const {
+    return count_.load(std::memory_order_relaxed);
+}
+
+int64_t
+Histogram::
+Sum() const {
+    return sum_.load(std::memory_order_relaxed);
+}
+
+int64_t
+Histogram::
+Min() const {
+    return Count() == 0 ? 0 : min_.load(std::memory_order_relaxed);
+}
+
+int64_t
+Histogram::
+Max() const {
+    return max_.load(std::memory_order_relaxed);
+}
+
+double
+Histogram::
+Mean() const {
+    auto count = Count();
+    return count == 0 ? 0.0 : static_cast<double>(Sum()) / count;
+}
+
+int64_t
+Histogram::
+Percentile(
+        double percentile
+) const {
+    auto count = Count();
+    if (count == 0) {
+        return 0;
+    }
+
+    percentile = std::clamp(percentile, 0.0, 100.0);
+    auto target = std::max<int64_t>(
+            1, static_cast<int64_t>(std::ceil(percentile / 100.0 * count)));
+
+    int64_t seen = 0;
+    for (size_t i = 0; i < kBucketCount; ++i) {
+        seen += counts_[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return std::min(BucketUpperBound(i), Max());
+        }
+    }
+
+    return Max();
+}
+
+std::vector<Histogram::Bucket>
+Histogram::
+Buckets() const {
+    std::vector<Bucket> buckets;
+    for (size_t i = 0; i < kBucketCount; ++i) {
+        auto count = counts_[i].load(std::memory_order_relaxed);
+        if (count != 0) {
+            buckets.push_back({BucketUpperBound(i), count});
+        }
+    }
+
+    return buckets;
+}
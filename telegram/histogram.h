@@ -0,0 +1,63 @@
+#ifndef TELEGRAM_HISTOGRAM_H
+#define TELEGRAM_HISTOGRAM_H
+
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+//  HDR-style log-linear histogram of non-negative integer values
+//  (usually microseconds or bytes). Values below 2^kSubBucketBits are
+//  stored exactly, larger ones with relative error below
+//  2^-(kSubBucketBits - 1), i.e. about 3%.
+//
+//  Record() is lock-free and may be called from any number of threads.
+class Histogram {
+public:
+    Histogram() = default;
+    Histogram(const Histogram& other);
+    Histogram& operator=(const Histogram& other);
+
+    void Record(int64_t value);
+    void Merge(const Histogram& other);
+    void Reset();
+
+    int64_t Count() const;
+    int64_t Sum() const;
+    int64_t Min() const;
+    int64_t Max() const;
+    double Mean() const;
+
+    //  Highest value equivalent to the one at the given percentile (0..100)
+    int64_t Percentile(double percentile) const;
+
+    struct Bucket {
+        int64_t upper_bound;
+        int64_t count;
+    };
+
+    //  Non-empty buckets in ascending order
+    std::vector<Bucket> Buckets() const;
+
+private:
+    static constexpr int kSubBucketBits = 6;
+    static constexpr int64_t kSubBucketCount = int64_t{1} << kSubBucketBits;
+    static constexpr int64_t kSubBucketHalf = kSubBucketCount / 2;
+    static constexpr size_t kBucketCount =
+            (64 - kSubBucketBits) * kSubBucketHalf + kSubBucketHalf;
+
+    static size_t BucketIndex(int64_t value);
+    static int64_t BucketUpperBound(size_t index);
+
+    std::array<std::atomic<int64_t>, kBucketCount> counts_{};
+    std::atomic<int64_t> count_{0};
+    std::atomic<int64_t> sum_{0};
+    std::atomic<int64_t> min_{INT64_MAX};
+    std::atomic<int64_t> max_{0};
+};
+
+
+#endif //TELEGRAM_HISTOGRAM_H
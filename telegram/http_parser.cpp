@@ -0,0 +1,270 @@
+#include "http_parser.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <stdexcept>
+
+
+namespace {
+
+constexpr size_t kMaxLineSize = 16 * 1024;
+
+bool
+EqualsIgnoreCase(
+        std::string_view lhs,
+        std::string_view rhs
+) {
+    return lhs.size() == rhs.size() &&
+           std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](char a, char b) {
+               return std::tolower(static_cast<unsigned char>(a)) ==
+                      std::tolower(static_cast<unsigned char>(b));
+           });
+}
+
+std::string_view
+Trim(
+        std::string_view value
+) {
+    while (!value.empty() && std::isspace(static_cast<unsigned char>(value.front()))) {
+        value.remove_prefix(1);
+    }
+    while (!value.empty() && std::isspace(static_cast<unsigned char>(value.back()))) {
+        value.remove_suffix(1);
+    }
+
+    return value;
+}
+
+template <class Int>
+Int
+ParseNumber(
+        std::string_view value,
+        int base,
+        const char* what
+) {
+    Int result = 0;
+    auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result, base);
+    if (error != std::errc() || end == value.data() || result < 0) {
+        throw std::runtime_error(std::string("Invalid ") + what + ": " + std::string(value));
+    }
+
+    return result;
+}
+
+}  // namespace
+
+
+size_t
+HttpResponseParser::
+Feed(
+        const char* data,
+        size_t size
+) {
+    const char* begin = data;
+    const char* end = data + size;
+    if (size > 0) {
+        started_ = true;
+    }
+
+    while (data < end && state_ != State::Done) {
+        switch (state_) {
+            case State::StatusLine:
+                if (ReadLine(data, end)) {
+                    ParseStatusLine(line_);
+                    line_.clear();
+                    state_ = State::Headers;
+                }
+                break;
+
+            case State::Headers:
+                if (ReadLine(data, end)) {
+                    if (line_.empty()) {
+                        EndHeaders();
+                    } else {
+                        ParseHeader(line_);
+                    }
+                    line_.clear();
+                }
+                break;
+
+            case State::Body:
+            case State::ChunkData: {
+                auto count = std::min<int64_t>(remaining_, end - data);
+                body_.append(data, count);
+                data += count;
+                remaining_ -= count;
+                if (remaining_ == 0) {
+                    state_ = state_ == State::Body ? State::Done : State::ChunkDataEnd;
+                }
+                break;
+            }
+
+            case State::ChunkDataEnd:
+                if (ReadLine(data, end)) {
+                    if (!line_.empty()) {
+                        throw std::runtime_error("Chunk is longer than its size");
+                    }
+                    state_ = State::ChunkSize;
+                }
+                break;
+
+            case State::ChunkSize:
+                if (ReadLine(data, end)) {
+                    //  Chunk extensions follow ';'
+                    std::string_view size_line = line_;
+                    size_line = Trim(size_line.substr(0, size_line.find(';')));
+                    remaining_ = ParseNumber<int64_t>(size_line, 16, "chunk size");
+                    line_.clear();
+                    state_ = remaining_ == 0 ? State::Trailers : State::ChunkData;
+                }
+                break;
+
+            case State::Trailers:
+                if (ReadLine(data, end)) {
+                    if (line_.empty()) {
+                        state_ = State::Done;
+                    }
+                    line_.clear();
+                }
+                break;
+
+            case State::UntilClose:
+                body_.append(data, end - data);
+                data = end;
+                break;
+
+            case State::Done:
+                break;
+        }
+    }
+
+    return data - begin;
+}
+
+bool
+HttpResponseParser::
+FinishOnEof() {
+    if (state_ == State::UntilClose) {
+        state_ = State::Done;
+        return true;
+    }
+
+    return state_ == State::Done;
+}
+
+void
+HttpResponseParser::
+Reset() {
+    state_ = State::StatusLine;
+    started_ = false;
+    line_.clear();
+    status_ = 0;
+    keep_alive_ = true;
+    connection_close_ = false;
+    chunked_ = false;
+    content_length_ = -1;
+    retry_after_ = 0;
+    remaining_ = 0;
+    body_.clear();
+}
+
+bool
+HttpResponseParser::
+ReadLine(
+        const char*& data,
+        const char* end
+) {
+    auto newline = std::find(data, end, '\n');
+    line_.append(data, newline);
+    if (line_.size() > kMaxLineSize) {
+        throw std::runtime_error("Response line is too long");
+    }
+
+    if (newline == end) {
+        data = end;
+        return false;
+    }
+
+    data = newline + 1;
+    if (!line_.empty() && line_.back() == '\r') {
+        line_.pop_back();
+    }
+
+    return true;
+}
+
+void
+HttpResponseParser::
+ParseStatusLine(
+        std::string_view line
+) {
+    //  "HTTP/1.1 200 OK"
+    if (line.substr(0, 5) != "HTTP/" || line.size() < 12 || line[8] != ' ') {
+        throw std::runtime_error("Invalid status line: " + std::string(line));
+    }
+
+    status_ = ParseNumber<int>(line.substr(9, 3), 10, "status");
+    keep_alive_ = line.substr(5, 3) != "1.0";
+}
+
+void
+HttpResponseParser::
+ParseHeader(
+        std::string_view line
+) {
+    auto colon = line.find(':');
+    if (colon == std::string_view::npos) {
+        throw std::runtime_error("Invalid header: " + std::string(line));
+    }
+
+    auto name = Trim(line.substr(0, colon));
+    auto value = Trim(line.substr(colon + 1));
+
+    if (EqualsIgnoreCase(name, "Content-Length")) {
+        content_length_ = ParseNumber<int64_t>(value, 10, "Content-Length");
+    } else if (EqualsIgnoreCase(name, "Transfer-Encoding")) {
+        chunked_ = EqualsIgnoreCase(value, "chunked");
+    } else if (EqualsIgnoreCase(name, "Connection")) {
+        if (EqualsIgnoreCase(value, "close")) {
+            keep_alive_ = false;
+            connection_close_ = true;
+        } else if (EqualsIgnoreCase(value, "keep-alive")) {
+            keep_alive_ = true;
+        }
+    } else if (EqualsIgnoreCase(name, "Retry-After")) {
+        //  May also be an HTTP-date, which is not worth a failed connection
+        int32_t seconds = 0;
+        auto end = value.data() + value.size();
+        auto [ptr, error] = std::from_chars(value.data(), end, seconds);
+        if (error == std::errc() && ptr == end && seconds >= 0) {
+            retry_after_ = seconds;
+        }
+    }
+}
+
+void
+HttpResponseParser::
+EndHeaders() {
+    //  Interim responses, e.g. 100 Continue, are followed by the real one
+    if (status_ / 100 == 1) {
+        state_ = State::StatusLine;
+        return;
+    }
+
+    if (status_ == 204 || status_ == 304) {
+        state_ = State::Done;
+    } else if (chunked_) {
+        state_ = State::ChunkSize;
+    } else if (content_length_ >= 0) {
+        remaining_ = content_length_;
+        state_ = remaining_ == 0 ? State::Done : State::Body;
+    } else {
+        keep_alive_ = false;
+        state_ = State::UntilClose;
+    }
+
+    if (content_length_ > 0) {
+        body_.reserve(content_length_);
+    }
+}
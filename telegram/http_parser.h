@@ -0,0 +1,78 @@
+#ifndef TELEGRAM_HTTP_PARSER_H
+#define TELEGRAM_HTTP_PARSER_H
+
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+
+//  Incremental HTTP/1.1 response parser for the event loop transports.
+//  Bytes are fed as they arrive, in pieces of any size. Bodies may be
+//  delimited by Content-Length, chunked encoding or connection close.
+//  Throws std::runtime_error on malformed responses.
+class HttpResponseParser {
+public:
+    //  Consumes bytes of the current response and returns how many were
+    //  used; the rest belong to the next pipelined response.
+    size_t Feed(const char* data, size_t size);
+
+    //  The connection was closed. Returns true if that completed the
+    //  response, i.e. its body is delimited by connection close.
+    bool FinishOnEof();
+
+    //  Starts the next response. Keeps the body capacity.
+    void Reset();
+
+    bool Done() const { return state_ == State::Done; }
+    //  Some bytes of a response were received
+    bool Started() const { return started_; }
+
+    int Status() const { return status_; }
+    bool KeepAlive() const { return keep_alive_; }
+    //  "Connection: close" was sent: the server processes no later
+    //  request of this connection (RFC 7230, 6.6)
+    bool ConnectionClose() const { return connection_close_; }
+    //  0 if absent
+    int32_t RetryAfter() const { return retry_after_; }
+    const std::string& Body() const { return body_; }
+    std::string& Body() { return body_; }
+
+private:
+    enum class State {
+        StatusLine,
+        Headers,
+        Body,
+        ChunkSize,
+        ChunkData,
+        ChunkDataEnd,
+        Trailers,
+        UntilClose,
+        Done
+    };
+
+    //  Appends to line_ up to '\n'; true once a full line is there
+    bool ReadLine(const char*& data, const char* end);
+    void ParseStatusLine(std::string_view line);
+    void ParseHeader(std::string_view line);
+    void EndHeaders();
+
+    State state_ = State::StatusLine;
+    bool started_ = false;
+    std::string line_;
+
+    int status_ = 0;
+    bool keep_alive_ = true;
+    bool connection_close_ = false;
+    bool chunked_ = false;
+    int64_t content_length_ = -1;
+    int32_t retry_after_ = 0;
+
+    //  Body bytes or chunk bytes still expected
+    int64_t remaining_ = 0;
+    std::string body_;
+};
+
+
+#endif //TELEGRAM_HTTP_PARSER_H
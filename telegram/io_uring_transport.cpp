@@ -0,0 +1,549 @@
+#include "event_loop_transport.h"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace {
+
+constexpr size_t kBufferSize = 64 * 1024;
+
+//  user_data: operation, connection generation (low 24 bits) and index
+enum class Op : uint64_t {
+    Wake = 1,
+    Deadline,
+    Connect,
+    ConnectTimeout,
+    Read,
+    Write,
+    Ignored
+};
+
+uint64_t
+MakeUserData(
+        Op op,
+        uint32_t generation,
+        size_t index
+) {
+    return (static_cast<uint64_t>(op) << 56) |
+           (uint64_t{generation & 0xffffff} << 32) |
+           static_cast<uint32_t>(index);
+}
+
+Op UserDataOp(uint64_t user_data) { return static_cast<Op>(user_data >> 56); }
+uint32_t UserDataGeneration(uint64_t user_data) { return (user_data >> 32) & 0xffffff; }
+size_t UserDataIndex(uint64_t user_data) { return static_cast<uint32_t>(user_data); }
+
+__kernel_timespec
+ToTimespec(
+        std::chrono::nanoseconds duration
+) {
+    __kernel_timespec timespec{};
+    timespec.tv_sec = duration.count() / 1000000000;
+    timespec.tv_nsec = duration.count() % 1000000000;
+    return timespec;
+}
+
+
+//  Completion-based backend over raw io_uring syscalls. Submissions of a
+//  whole loop iteration go to the kernel in one io_uring_enter, which
+//  also waits for completions. Each connection reads into its own
+//  registered buffer and sends from a buffer of its own; connects carry
+//  a linked timeout, and one absolute timeout wakes the loop for the
+//  earliest deadline.
+class IoUringTransport : public EventLoopTransport {
+public:
+    explicit IoUringTransport(const TransportOptions& options);
+    ~IoUringTransport() override;
+
+private:
+    //  Kernel operations of a connection slot. They may outlive the
+    //  connection that started them, and the buffers are not reused
+    //  until they complete.
+    struct Slot {
+        bool read_pending = false;
+        bool write_pending = false;
+        __kernel_timespec connect_timeout{};
+    };
+
+    void Run() override;
+    void Connect(Connection& connection) override;
+    void Write(Connection& connection) override;
+    void CloseSocket(Connection& connection) override;
+
+    void SetupRing(unsigned entries);
+    void RegisterBuffers();
+    io_uring_sqe& NextSqe();
+    void Enter(unsigned min_complete);
+    void HandleCompletions();
+    void HandleCompletion(uint64_t user_data, int result);
+
+    void PollWakeFd();
+    void ArmDeadline(Clock::time_point deadline);
+    void StartRead(Connection& connection);
+    char* ReadBuffer(size_t index) { return buffers_.get() + index * kBufferSize; }
+    char* WriteBuffer(size_t index) { return ReadBuffer(connections_.size() + index); }
+
+    int ring_fd_ = -1;
+    io_uring_params params_{};
+
+    void* sq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    void* cq_ring_ = nullptr;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    unsigned* sq_head_ = nullptr;
+    unsigned* sq_tail_ = nullptr;
+    unsigned* sq_array_ = nullptr;
+    unsigned sq_mask_ = 0;
+    unsigned sqe_tail_ = 0;
+    unsigned to_submit_ = 0;
+
+    unsigned* cq_head_ = nullptr;
+    unsigned* cq_tail_ = nullptr;
+    unsigned cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    //  Read buffers of every slot, then write buffers
+    std::unique_ptr<char[]> buffers_;
+    bool buffers_registered_ = false;
+    std::vector<Slot> slots_;
+
+    //  The armed loop timeout, told apart from removed ones by sequence
+    Clock::time_point armed_deadline_ = Clock::time_point::max();
+    uint32_t deadline_sequence_ = 0;
+    __kernel_timespec deadline_timespec_{};
+};
+
+
+IoUringTransport::
+IoUringTransport(
+        const TransportOptions& options
+):
+        EventLoopTransport{options},
+        buffers_{new char[2 * connections_.size() * kBufferSize]},
+        slots_(connections_.size())
+{
+    //  Per connection: connect and its timeout, read, write; plus the
+    //  wake poll and the loop timeout with its removal
+    SetupRing(static_cast<unsigned>(4 * connections_.size() + 8));
+    RegisterBuffers();
+    StartLoop();
+}
+
+IoUringTransport::
+~IoUringTransport() {
+    StopLoop();
+
+    //  Outstanding operations are cancelled with the ring; registered
+    //  pages stay pinned by the kernel until then
+    munmap(sqes_, sqes_size_);
+    if (cq_ring_ != sq_ring_) {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    munmap(sq_ring_, sq_ring_size_);
+    close(ring_fd_);
+}
+
+void
+IoUringTransport::
+SetupRing(
+        unsigned entries
+) {
+    ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params_));
+    if (ring_fd_ < 0) {
+        throw std::runtime_error(std::string("io_uring_setup failed: ") + strerror(errno));
+    }
+
+    auto fail = [this](const char* what) {
+        auto error = std::string(what) + " failed: " + strerror(errno);
+        close(ring_fd_);
+        throw std::runtime_error(error);
+    };
+
+    sq_ring_size_ = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params_.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED) {
+        fail("io_uring sq ring mmap");
+    }
+
+    cq_ring_ = sq_ring_;
+    if (!single_mmap) {
+        cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED) {
+            munmap(sq_ring_, sq_ring_size_);
+            fail("io_uring cq ring mmap");
+        }
+    }
+
+    sqes_size_ = params_.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                                            MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED) {
+        if (cq_ring_ != sq_ring_) {
+            munmap(cq_ring_, cq_ring_size_);
+        }
+        munmap(sq_ring_, sq_ring_size_);
+        fail("io_uring sqes mmap");
+    }
+
+    auto sq = static_cast<char*>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.tail);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params_.sq_off.array);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + params_.sq_off.ring_mask);
+    sqe_tail_ = *sq_tail_;
+
+    auto cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params_.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + params_.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params_.cq_off.cqes);
+}
+
+void
+IoUringTransport::
+RegisterBuffers() {
+    //  Only reads use them: a write to a reset socket raises SIGPIPE,
+    //  and only send() takes MSG_NOSIGNAL
+    std::vector<iovec> iovecs(connections_.size());
+    for (size_t i = 0; i < iovecs.size(); ++i) {
+        iovecs[i].iov_base = ReadBuffer(i);
+        iovecs[i].iov_len = kBufferSize;
+    }
+
+    //  Without registration (e.g. a low RLIMIT_MEMLOCK on older kernels)
+    //  the same buffers are used by plain reads
+    buffers_registered_ = syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS,
+                                  iovecs.data(), static_cast<unsigned>(iovecs.size())) == 0;
+}
+
+io_uring_sqe&
+IoUringTransport::
+NextSqe() {
+    if (sqe_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) == params_.sq_entries) {
+        Enter(0);
+    }
+
+    auto index = sqe_tail_ & sq_mask_;
+    auto& sqe = sqes_[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sq_array_[index] = index;
+    ++sqe_tail_;
+    ++to_submit_;
+    return sqe;
+}
+
+void
+IoUringTransport::
+Enter(
+        unsigned min_complete
+) {
+    __atomic_store_n(sq_tail_, sqe_tail_, __ATOMIC_RELEASE);
+
+    while (true) {
+        unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+        auto submitted = syscall(__NR_io_uring_enter, ring_fd_, to_submit_, min_complete,
+                                 flags, nullptr, 0);
+        if (submitted >= 0) {
+            to_submit_ -= static_cast<unsigned>(submitted);
+            if (to_submit_ == 0 || min_complete > 0) {
+                return;
+            }
+        } else if (errno == EBUSY || errno == EAGAIN) {
+            //  Completion queue is full: make room and try again
+            HandleCompletions();
+        } else if (errno != EINTR) {
+            throw std::runtime_error(std::string("io_uring_enter failed: ") + strerror(errno));
+        }
+    }
+}
+
+void
+IoUringTransport::
+Run() {
+    try {
+        PollWakeFd();
+        while (!StopRequested()) {
+            Pump();
+            FlushWrites();
+            ArmDeadline(NextDeadline());
+
+            Enter(1);
+            HandleCompletions();
+        }
+
+        FailAll("Transport is stopped");
+    } catch (const std::exception& e) {
+        FailAll(e.what());
+    }
+}
+
+void
+IoUringTransport::
+HandleCompletions() {
+    auto head = *cq_head_;
+    while (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        auto cqe = cqes_[head & cq_mask_];
+        __atomic_store_n(cq_head_, ++head, __ATOMIC_RELEASE);
+
+        HandleCompletion(cqe.user_data, cqe.res);
+        head = *cq_head_;
+    }
+}
+
+void
+IoUringTransport::
+HandleCompletion(
+        uint64_t user_data,
+        int result
+) {
+    auto op = UserDataOp(user_data);
+    if (op == Op::Wake) {
+        DrainWakeFd();
+        PollWakeFd();
+        return;
+    }
+    if (op == Op::Deadline) {
+        if (UserDataGeneration(user_data) == (deadline_sequence_ & 0xffffff)) {
+            armed_deadline_ = Clock::time_point::max();
+        }
+        return;
+    }
+    if (op == Op::ConnectTimeout || op == Op::Ignored) {
+        return;
+    }
+
+    auto index = UserDataIndex(user_data);
+    auto& connection = connections_[index];
+    auto& slot = slots_[index];
+    bool current = UserDataGeneration(user_data) == (connection.generation & 0xffffff) &&
+                   connection.state != Connection::State::Closed;
+
+    switch (op) {
+        case Op::Connect:
+            if (!current) {
+                return;
+            }
+            if (result < 0) {
+                CloseConnection(connection, result == -ECANCELED
+                                            ? std::string("Connect timed out")
+                                            : std::string("Connect failed: ") + strerror(-result),
+                                true);
+                return;
+            }
+
+            OnConnected(connection);
+            StartRead(connection);
+            return;
+
+        case Op::Read: {
+            slot.read_pending = false;
+            if (!current) {
+                //  A read of a closed connection held the buffer
+                if (connection.state == Connection::State::Open ||
+                        connection.state == Connection::State::Handshaking) {
+                    StartRead(connection);
+                }
+                return;
+            }
+
+            auto generation = connection.generation;
+            if (result > 0) {
+                OnReceived(connection, ReadBuffer(index), result);
+            } else if (result == 0) {
+                OnEof(connection);
+            } else if (result != -EINTR && result != -EAGAIN) {
+                CloseConnection(connection, std::string("Receive failed: ") + strerror(-result),
+                                connection.state != Connection::State::Open);
+            }
+
+            if (connection.generation == generation && result != 0) {
+                StartRead(connection);
+            }
+            return;
+        }
+
+        case Op::Write:
+            slot.write_pending = false;
+            if (current) {
+                if (result < 0 && result != -EINTR && result != -EAGAIN) {
+                    CloseConnection(connection, std::string("Send failed: ") + strerror(-result));
+                    return;
+                }
+                if (result > 0) {
+                    OnWritten(connection, result);
+                }
+            }
+
+            //  More may have been queued meanwhile, maybe by a newer connection
+            if (connection.state != Connection::State::Closed &&
+                    connection.out_offset < connection.out.size()) {
+                Write(connection);
+            }
+            return;
+
+        default:
+            return;
+    }
+}
+
+void
+IoUringTransport::
+PollWakeFd() {
+    auto& sqe = NextSqe();
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = WakeFd();
+    sqe.poll32_events = POLLIN;
+    sqe.user_data = MakeUserData(Op::Wake, 0, 0);
+}
+
+void
+IoUringTransport::
+ArmDeadline(
+        Clock::time_point deadline
+) {
+    if (deadline >= armed_deadline_) {
+        return;
+    }
+
+    if (armed_deadline_ != Clock::time_point::max()) {
+        auto& remove = NextSqe();
+        remove.opcode = IORING_OP_TIMEOUT_REMOVE;
+        remove.fd = -1;
+        remove.addr = MakeUserData(Op::Deadline, deadline_sequence_, 0);
+        remove.user_data = MakeUserData(Op::Ignored, 0, 0);
+    }
+
+    //  steady_clock is CLOCK_MONOTONIC, the clock of absolute timeouts
+    ++deadline_sequence_;
+    armed_deadline_ = deadline;
+    deadline_timespec_ = ToTimespec(deadline.time_since_epoch());
+
+    auto& sqe = NextSqe();
+    sqe.opcode = IORING_OP_TIMEOUT;
+    sqe.fd = -1;
+    sqe.addr = reinterpret_cast<uint64_t>(&deadline_timespec_);
+    sqe.len = 1;
+    sqe.timeout_flags = IORING_TIMEOUT_ABS;
+    sqe.user_data = MakeUserData(Op::Deadline, deadline_sequence_, 0);
+}
+
+void
+IoUringTransport::
+Connect(
+        Connection& connection
+) {
+    //  io_uring honors O_NONBLOCK with -EAGAIN instead of waiting, and
+    //  never blocks the loop on a blocking socket
+    fcntl(connection.fd, F_SETFL, fcntl(connection.fd, F_GETFL) & ~O_NONBLOCK);
+
+    auto& slot = slots_[connection.index];
+    slot.connect_timeout = ToTimespec(std::max(connection.connect_deadline - Clock::now(),
+                                               Clock::duration::zero()));
+
+    auto& sqe = NextSqe();
+    sqe.opcode = IORING_OP_CONNECT;
+    sqe.fd = connection.fd;
+    sqe.addr = reinterpret_cast<uint64_t>(Address());
+    sqe.off = AddressSize();
+    sqe.flags = IOSQE_IO_LINK;
+    sqe.user_data = MakeUserData(Op::Connect, connection.generation, connection.index);
+
+    auto& timeout = NextSqe();
+    timeout.opcode = IORING_OP_LINK_TIMEOUT;
+    timeout.fd = -1;
+    timeout.addr = reinterpret_cast<uint64_t>(&slot.connect_timeout);
+    timeout.len = 1;
+    timeout.user_data = MakeUserData(Op::ConnectTimeout, connection.generation, connection.index);
+}
+
+void
+IoUringTransport::
+StartRead(
+        Connection& connection
+) {
+    auto& slot = slots_[connection.index];
+    if (slot.read_pending || connection.state == Connection::State::Closed) {
+        return;
+    }
+
+    auto& sqe = NextSqe();
+    sqe.opcode = buffers_registered_ ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe.fd = connection.fd;
+    sqe.addr = reinterpret_cast<uint64_t>(ReadBuffer(connection.index));
+    sqe.len = kBufferSize;
+    sqe.buf_index = static_cast<uint16_t>(connection.index);
+    sqe.user_data = MakeUserData(Op::Read, connection.generation, connection.index);
+    slot.read_pending = true;
+}
+
+void
+IoUringTransport::
+Write(
+        Connection& connection
+) {
+    auto& slot = slots_[connection.index];
+    if (slot.write_pending || connection.state == Connection::State::Connecting) {
+        return;
+    }
+
+    //  Copied into the slot buffer: `out` may grow, and move,
+    //  while the kernel is still sending
+    auto size = std::min(connection.out.size() - connection.out_offset, kBufferSize);
+    std::memcpy(WriteBuffer(connection.index), connection.out.data() + connection.out_offset, size);
+
+    auto& sqe = NextSqe();
+    sqe.opcode = IORING_OP_SEND;
+    sqe.fd = connection.fd;
+    sqe.addr = reinterpret_cast<uint64_t>(WriteBuffer(connection.index));
+    sqe.len = static_cast<uint32_t>(size);
+    sqe.msg_flags = MSG_NOSIGNAL;
+    sqe.user_data = MakeUserData(Op::Write, connection.generation, connection.index);
+    slot.write_pending = true;
+}
+
+void
+IoUringTransport::
+CloseSocket(
+        Connection& connection
+) {
+    if (connection.fd < 0) {
+        return;
+    }
+
+    //  Pending operations hold the file open; shutdown() completes them,
+    //  close() alone would leave them waiting
+    shutdown(connection.fd, SHUT_RDWR);
+    close(connection.fd);
+}
+
+}  // namespace
+
+
+std::unique_ptr<AsyncTransport>
+MakeIoUringTransport(
+        const TransportOptions& options
+) {
+    return std::make_unique<IoUringTransport>(options);
+}
@@ -0,0 +1,171 @@
+#include "json_writer.h"
+
+#include <charconv>
+
+
+JsonWriter::
+JsonWriter(
+        std::string& buffer
+):
+        buffer_{buffer}
+{
+    buffer_.clear();
+}
+
+void
+JsonWriter::
+Separator() {
+    if (after_key_) {
+        after_key_ = false;
+        return;
+    }
+
+    if (has_elements_ & 1) {
+        buffer_ += ',';
+    }
+    has_elements_ |= 1;
+}
+
+JsonWriter&
+JsonWriter::
+BeginObject() {
+    Separator();
+    buffer_ += '{';
+    has_elements_ <<= 1;
+    return *this;
+}
+
+JsonWriter&
+JsonWriter::
+EndObject() {
+    buffer_ += '}';
+    has_elements_ >>= 1;
+    return *this;
+}
+
+JsonWriter&
+JsonWriter::
+BeginArray() {
+    Separator();
+    buffer_ += '[';
+    has_elements_ <<= 1;
+    return *this;
+}
+
+JsonWriter&
+JsonWriter::
+EndArray() {
+    buffer_ += ']';
+    has_elements_ >>= 1;
+    return *this;
+}
+
+JsonWriter&
+JsonWriter::
+Key(
+        std::string_view key
+) {
+    Separator();
+    AppendJsonString(buffer_, key);
+    buffer_ += ':';
+    after_key_ = true;
+    return *this;
+}
+
+JsonWriter&
+JsonWriter::
+Int(
+        int64_t value
+) {
+    Separator();
+
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    buffer_.append(digits, result.ptr);
+    return *this;
+}
+
+JsonWriter&
+JsonWriter::
+Bool(
+        bool value
+) {
+    Separator();
+    buffer_ += value ? "true" : "false";
+    return *this;
+}
+
+JsonWriter&
+JsonWriter::
+String(
+        std::string_view value
+) {
+    Separator();
+    AppendJsonString(buffer_, value);
+    return *this;
+}
+
+JsonWriter&
+JsonWriter::
+IntField(
+        std::string_view key,
+        int64_t value
+) {
+    return Key(key).Int(value);
+}
+
+JsonWriter&
+JsonWriter::
+BoolField(
+        std::string_view key,
+        bool value
+) {
+    return Key(key).Bool(value);
+}
+
+JsonWriter&
+JsonWriter::
+StringField(
+        std::string_view key,
+        std::string_view value
+) {
+    return Key(key).String(value);
+}
+
+
+void
+AppendJsonString(
+        std::string& buffer,
+        std::string_view value
+) {
+    static const char kHex[] = "0123456789abcdef";
+
+    buffer += '"';
+
+    //  Copy unescaped runs at once
+    size_t run_start = 0;
+    for (size_t i = 0; i < value.size(); ++i) {
+        auto c = static_cast<unsigned char>(value[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        buffer.append(value.data() + run_start, i - run_start);
+        run_start = i + 1;
+
+        switch (c) {
+            case '"':  buffer += "\\\""; break;
+            case '\\': buffer += "\\\\"; break;
+            case '\n': buffer += "\\n"; break;
+            case '\r': buffer += "\\r"; break;
+            case '\t': buffer += "\\t"; break;
+            default:
+                buffer += "\\u00";
+                buffer += kHex[c >> 4];
+                buffer += kHex[c & 0xf];
+        }
+    }
+
+    buffer.append(value.data() + run_start, value.size() - run_start);
+    buffer += '"';
+}
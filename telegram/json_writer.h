@@ -0,0 +1,48 @@
+#ifndef TELEGRAM_JSON_WRITER_H
+#define TELEGRAM_JSON_WRITER_H
+
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+
+//  Appends compact JSON to a caller-owned buffer. The buffer is cleared,
+//  not released, so a buffer kept between requests stops allocating once
+//  it has grown to the largest body. No validation is done: callers are
+//  expected to produce well-formed documents.
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& buffer);
+
+    JsonWriter& BeginObject();
+    JsonWriter& EndObject();
+    JsonWriter& BeginArray();
+    JsonWriter& EndArray();
+
+    JsonWriter& Key(std::string_view key);
+    JsonWriter& Int(int64_t value);
+    JsonWriter& Bool(bool value);
+    JsonWriter& String(std::string_view value);
+
+    JsonWriter& IntField(std::string_view key, int64_t value);
+    JsonWriter& BoolField(std::string_view key, bool value);
+    JsonWriter& StringField(std::string_view key, std::string_view value);
+
+    const std::string& str() const { return buffer_; }
+
+private:
+    void Separator();
+
+    std::string& buffer_;
+    //  Bit per nesting level: set once the level has an element
+    uint64_t has_elements_ = 0;
+    bool after_key_ = false;
+};
+
+
+//  Escapes `value` as a JSON string literal, quotes included
+void AppendJsonString(std::string& buffer, std::string_view value);
+
+
+#endif //TELEGRAM_JSON_WRITER_H
@@ -6,41 +6,71 @@
 #define TELEGRAM_LOGGER_H
 
 
+#include "async_channel.h"
+
 #include <Poco/AutoPtr.h>
-#include <Poco/Channel.h>
-#include <Poco/ConsoleChannel.h>
-#include <Poco/FormattingChannel.h>
 #include <Poco/Logger.h>
 #include <Poco/Message.h>
-#include <Poco/PatternFormatter.h>
+
+#include <cstdlib>
 
 
 using Poco::AutoPtr;
-using Poco::Channel;
-using Poco::ColorConsoleChannel;
-using Poco::FormattingChannel;
 using Poco::Logger;
-using Poco::PatternFormatter;
 
 
-Logger&
+using LogOptions = AsyncChannel::Options;
+
+
+inline LogOptions&
+GetLogOptions() {
+    static LogOptions options;
+    return options;
+}
+
+
+//  Takes effect only if called before the first GetLogger()
+inline void
+SetLogOptions(
+        const LogOptions& options
+) {
+    GetLogOptions() = options;
+}
+
+
+inline const AutoPtr<AsyncChannel>&
+GetLogChannel() {
+    static AutoPtr<AsyncChannel> channel(new AsyncChannel(GetLogOptions()));
+    return channel;
+}
+
+
+//  Writes whatever is still queued. Runs at exit, but not when the
+//  process ends in std::terminate, so call it before such an exit.
+inline void
+CloseLogChannel() {
+    GetLogChannel()->close();
+}
+
+
+//  Messages are handed to a background writer, see AsyncChannel
+inline Logger&
 InitLogger(
         const std::string& logger_name,
         Poco::Message::Priority priority
 ) {
-    AutoPtr<ColorConsoleChannel> channel(new ColorConsoleChannel());
-    AutoPtr<PatternFormatter> pattern_formatter(new PatternFormatter("%s: %p: %t"));
-    AutoPtr<FormattingChannel> formatting_channel(new FormattingChannel(pattern_formatter,
-                                                                        channel));
+    const auto& channel = GetLogChannel();
+    channel->open();
+    std::atexit(CloseLogChannel);
 
     return Logger::create(
             logger_name,
-            formatting_channel,
+            channel,
             priority);
 }
 
 
-Logger&
+inline Logger&
 GetLogger(
         const std::string& logger_name = "Log",
         Poco::Message::Priority priority = Poco::Message::PRIO_DEBUG
@@ -1,6 +1,9 @@
 #include "bot.h"
+#include "logger.h"
+#include "tracing.h"
 
-#include <ifstream>
+#include <cstdlib>
+#include <fstream>
 #include <string>
 
 std::string ReadToken(const std::string& tokenFile) {
@@ -22,7 +25,31 @@ std::string ReadName(const std::string& nameFile) {
 int main(int argc, char* argv[]) {
     const auto& kBotToken = ReadToken("token.txt");
     const auto& kBotFirstName = ReadName("name.txt");
+    //  Logs go to stderr unless a file is given
+    LogOptions log_options;
+    if (const char* log_file = std::getenv("BOT_LOG_FILE")) {
+        log_options.path = log_file;
+    }
+    SetLogOptions(log_options);
+
+    if (const char* trace_file = std::getenv("BOT_TRACE_FILE")) {
+        GetTracer().Start(trace_file);
+    }
+
     Bot bot(kBotToken, kBotFirstName, "information");
-    bot.Run();
+    if (const char* connections = std::getenv("BOT_PREWARM_CONNECTIONS")) {
+        bot.SetPrewarmConnections(std::stoul(connections));
+    }
+    //  Prometheus scrape endpoint, GET /metrics
+    if (const char* metrics_port = std::getenv("BOT_METRICS_PORT")) {
+        bot.StartMetricsServer(std::stoul(metrics_port));
+    }
+    try {
+        bot.Run();
+    } catch (const std::exception&) {
+        //  Bot::Run has logged the error, make sure it is written
+        CloseLogChannel();
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,406 @@
+#include "metrics.h"
+
+#include <Poco/Net/HTTPRequestHandler.h>
+#include <Poco/Net/HTTPRequestHandlerFactory.h>
+#include <Poco/Net/HTTPServer.h>
+#include <Poco/Net/HTTPServerParams.h>
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerResponse.h>
+#include <Poco/Net/ServerSocket.h>
+#include <Poco/Net/SocketAddress.h>
+
+#include <chrono>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+
+using Poco::Net::HTTPRequestHandler;
+using Poco::Net::HTTPRequestHandlerFactory;
+using Poco::Net::HTTPResponse;
+using Poco::Net::HTTPServer;
+using Poco::Net::HTTPServerParams;
+using Poco::Net::HTTPServerRequest;
+using Poco::Net::HTTPServerResponse;
+using Poco::Net::ServerSocket;
+using Poco::Net::SocketAddress;
+
+
+namespace {
+
+size_t
+ThreadShard() {
+    static std::atomic<size_t> next{0};
+    thread_local size_t shard = next.fetch_add(1, std::memory_order_relaxed);
+    return shard;
+}
+
+//  Label sets are kept rendered, which also gives a stable map key
+std::string
+RenderLabels(
+        const MetricLabels& labels
+) {
+    if (labels.empty()) {
+        return "";
+    }
+
+    std::string result = "{";
+    for (size_t i = 0; i < labels.size(); ++i) {
+        if (i > 0) {
+            result += ",";
+        }
+
+        result += labels[i].first + "=\"";
+        for (char c : labels[i].second) {
+            if (c == '\n') {
+                result += "\\n";
+                continue;
+            }
+
+            if (c == '"' || c == '\\') {
+                result += '\\';
+            }
+            result += c;
+        }
+        result += "\"";
+    }
+
+    return result + "}";
+}
+
+std::string
+AddLabel(
+        const std::string& labels,
+        const std::string& name,
+        const std::string& value
+) {
+    auto label = name + "=\"" + value + "\"";
+    if (labels.empty()) {
+        return "{" + label + "}";
+    }
+
+    return labels.substr(0, labels.size() - 1) + "," + label + "}";
+}
+
+}  // namespace
+
+
+//
+//      Counter
+//
+
+void
+Counter::
+Increment(
+        int64_t value
+) {
+    shards_[ThreadShard() % kShards].value.fetch_add(value, std::memory_order_relaxed);
+}
+
+int64_t
+Counter::
+Value() const {
+    int64_t total = 0;
+    for (const auto& shard : shards_) {
+        total += shard.value.load(std::memory_order_relaxed);
+    }
+
+    return total;
+}
+
+
+//
+//      MetricsRegistry
+//
+
+MetricsRegistry::Family&
+MetricsRegistry::
+GetFamily(
+        const std::string& name,
+        Type type,
+        const std::string& help
+) {
+    auto it = families_.find(name);
+    if (it == families_.end()) {
+        it = families_.emplace(name, Family{}).first;
+        it->second.type = type;
+        it->second.help = help;
+    }
+
+    if (it->second.type != type) {
+        throw std::logic_error("Metric '" + name + "' registered with another type");
+    }
+
+    return it->second;
+}
+
+Counter&
+MetricsRegistry::
+GetCounter(
+        const std::string& name,
+        const MetricLabels& labels,
+        const std::string& help
+) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto& counter = GetFamily(name, Type::Counter, help).counters[RenderLabels(labels)];
+    if (!counter) {
+        counter = std::make_unique<Counter>();
+    }
+
+    return *counter;
+}
+
+Gauge&
+MetricsRegistry::
+GetGauge(
+        const std::string& name,
+        const MetricLabels& labels,
+        const std::string& help
+) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto& gauge = GetFamily(name, Type::Gauge, help).gauges[RenderLabels(labels)];
+    if (!gauge) {
+        gauge = std::make_unique<Gauge>();
+    }
+
+    return *gauge;
+}
+
+Histogram&
+MetricsRegistry::
+GetHistogram(
+        const std::string& name,
+        const MetricLabels& labels,
+        const std::string& help,
+        double scale
+) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto& family = GetFamily(name, Type::Summary, help);
+    family.scale = scale;
+
+    auto& histogram = family.histograms[RenderLabels(labels)];
+    if (!histogram) {
+        histogram = std::make_unique<Histogram>();
+    }
+
+    return *histogram;
+}
+
+std::string
+MetricsRegistry::
+RenderPrometheus() const {
+    static const std::vector<std::pair<std::string, double>> kQuantiles = {
+            {"0.5", 50.0},
+            {"0.9", 90.0},
+            {"0.99", 99.0},
+            {"0.999", 99.9}
+    };
+
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    std::ostringstream out;
+    for (const auto& [name, family] : families_) {
+        out << "# HELP " << name << " " << family.help << "\n";
+
+        switch (family.type) {
+            case Type::Counter:
+                out << "# TYPE " << name << " counter\n";
+                for (const auto& [labels, counter] : family.counters) {
+                    out << name << labels << " " << counter->Value() << "\n";
+                }
+                break;
+
+            case Type::Gauge:
+                out << "# TYPE " << name << " gauge\n";
+                for (const auto& [labels, gauge] : family.gauges) {
+                    out << name << labels << " " << gauge->Value() << "\n";
+                }
+                break;
+
+            case Type::Summary:
+                out << "# TYPE " << name << " summary\n";
+                for (const auto& [labels, histogram] : family.histograms) {
+                    for (const auto& [quantile, percentile] : kQuantiles) {
+                        out << name << AddLabel(labels, "quantile", quantile) << " "
+                            << histogram->Percentile(percentile) * family.scale << "\n";
+                    }
+
+                    out << name << "_sum" << labels << " "
+                        << histogram->Sum() * family.scale << "\n";
+                    out << name << "_count" << labels << " "
+                        << histogram->Count() << "\n";
+                }
+                break;
+        }
+    }
+
+    return out.str();
+}
+
+MetricsRegistry&
+GetMetricsRegistry() {
+    static MetricsRegistry registry;
+    return registry;
+}
+
+
+//
+//      ApiMethodMetrics
+//
+
+ApiMethodMetrics::
+ApiMethodMetrics(
+        const std::string& method,
+        MetricsRegistry& registry
+):
+        method{method},
+        registry{registry},
+        requests{registry.GetCounter(
+                "telegram_requests_total", {{"method", method}},
+                "Bot API requests started")},
+        errors{registry.GetCounter(
+                "telegram_request_errors_total", {{"method", method}},
+                "Bot API requests failed with an exception")},
+        retries{registry.GetCounter(
+                "telegram_request_retries_total", {{"method", method}},
+                "Bot API requests repeated after a failure")},
+        latency{registry.GetHistogram(
+                "telegram_request_duration_seconds", {{"method", method}},
+                "Bot API request latency, including response parsing", 1e-6)},
+        response_bytes{registry.GetHistogram(
+                "telegram_response_size_bytes", {{"method", method}},
+                "Bot API response body size")},
+        parse_time{registry.GetHistogram(
+                "telegram_response_parse_duration_seconds", {{"method", method}},
+                "Bot API response parsing time", 1e-6)},
+        status_ok{ResponseStatus(200)}
+{}
+
+Counter&
+ApiMethodMetrics::
+ResponseStatus(
+        int status
+) {
+    return registry.GetCounter(
+            "telegram_responses_total",
+            {{"method", method}, {"status", std::to_string(status)}},
+            "Bot API responses by HTTP status");
+}
+
+
+//
+//      ScopedApiRequest
+//
+
+ScopedApiRequest::
+ScopedApiRequest(
+        ApiMethodMetrics& metrics
+):
+        metrics_{metrics},
+        start_{NowMicroseconds()},
+        exceptions_{std::uncaught_exceptions()}
+{
+    metrics_.requests.Increment();
+}
+
+ScopedApiRequest::
+~ScopedApiRequest() {
+    metrics_.latency.Record(NowMicroseconds() - start_);
+    if (std::uncaught_exceptions() > exceptions_) {
+        metrics_.errors.Increment();
+    }
+}
+
+
+//
+//      MetricsServer
+//
+
+namespace {
+
+class MetricsHandler : public HTTPRequestHandler {
+public:
+    explicit MetricsHandler(MetricsRegistry& registry): registry_{registry} {}
+
+    void handleRequest(HTTPServerRequest& request, HTTPServerResponse& response) override {
+        if (request.getURI() != "/metrics") {
+            response.setStatus(HTTPResponse::HTTP_NOT_FOUND);
+            response.setContentLength(0);
+            response.send();
+            return;
+        }
+
+        auto body = registry_.RenderPrometheus();
+        response.setStatus(HTTPResponse::HTTP_OK);
+        response.setContentType("text/plain; version=0.0.4");
+        response.setContentLength(body.size());
+        response.send() << body;
+    }
+
+private:
+    MetricsRegistry& registry_;
+};
+
+class MetricsHandlerFactory : public HTTPRequestHandlerFactory {
+public:
+    explicit MetricsHandlerFactory(MetricsRegistry& registry): registry_{registry} {}
+
+    HTTPRequestHandler* createRequestHandler(const HTTPServerRequest&) override {
+        return new MetricsHandler(registry_);
+    }
+
+private:
+    MetricsRegistry& registry_;
+};
+
+}  // namespace
+
+MetricsServer::
+MetricsServer(
+        uint16_t port,
+        MetricsRegistry& registry
+):
+        port_{port},
+        registry_{registry}
+{}
+
+MetricsServer::
+~MetricsServer() {
+    Stop();
+}
+
+void
+MetricsServer::
+Start() {
+    socket_ = std::make_unique<ServerSocket>(SocketAddress("localhost", port_));
+    port_ = socket_->address().port();
+
+    HTTPServerParams::Ptr params = new HTTPServerParams();
+    params->setMaxThreads(2);
+
+    server_ = std::make_unique<HTTPServer>(
+            new MetricsHandlerFactory(registry_), *socket_, params);
+    server_->start();
+}
+
+void
+MetricsServer::
+Stop() {
+    if (server_) {
+        server_->stop();
+        server_.reset();
+        socket_.reset();
+    }
+}
+
+uint16_t
+MetricsServer::
+GetPort() const {
+    return port_;
+}
+
+
+int64_t
+NowMicroseconds() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,168 @@
+#ifndef TELEGRAM_METRICS_H
+#define TELEGRAM_METRICS_H
+
+
+#include "histogram.h"
+
+#include <array>
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace Poco {
+namespace Net {
+class HTTPServer;
+class ServerSocket;
+}
+}
+
+
+using MetricLabels = std::vector<std::pair<std::string, std::string>>;
+
+
+//  Monotonic counter sharded by thread, so that hot paths on different
+//  threads never contend on one cache line.
+class Counter {
+public:
+    void Increment(int64_t value = 1);
+    int64_t Value() const;
+
+private:
+    static constexpr size_t kShards = 16;
+
+    struct alignas(64) Shard {
+        std::atomic<int64_t> value{0};
+    };
+
+    std::array<Shard, kShards> shards_;
+};
+
+
+class Gauge {
+public:
+    void Set(int64_t value) { value_.store(value, std::memory_order_relaxed); }
+    void Add(int64_t value) { value_.fetch_add(value, std::memory_order_relaxed); }
+    int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> value_{0};
+};
+
+
+//  Named metric families with labels. Get* creates a metric on first use
+//  and returns the same object afterwards, so callers look metrics up
+//  once and keep the reference. Histograms are exported as Prometheus
+//  summaries; recorded values are multiplied by `scale` on export
+//  (e.g. 1e-6 for microseconds exported as seconds).
+class MetricsRegistry {
+public:
+    Counter& GetCounter(
+            const std::string& name,
+            const MetricLabels& labels,
+            const std::string& help);
+
+    Gauge& GetGauge(
+            const std::string& name,
+            const MetricLabels& labels,
+            const std::string& help);
+
+    Histogram& GetHistogram(
+            const std::string& name,
+            const MetricLabels& labels,
+            const std::string& help,
+            double scale = 1.0);
+
+    //  Prometheus text exposition format, version 0.0.4
+    std::string RenderPrometheus() const;
+
+private:
+    enum class Type {
+        Counter,
+        Gauge,
+        Summary
+    };
+
+    struct Family {
+        Type type;
+        std::string help;
+        double scale = 1.0;
+        std::map<std::string, std::unique_ptr<Counter>> counters;
+        std::map<std::string, std::unique_ptr<Gauge>> gauges;
+        std::map<std::string, std::unique_ptr<Histogram>> histograms;
+    };
+
+    Family& GetFamily(const std::string& name, Type type, const std::string& help);
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Family> families_;
+};
+
+
+MetricsRegistry& GetMetricsRegistry();
+
+
+//  Metrics of one Bot API method, e.g. "sendMessage"
+struct ApiMethodMetrics {
+    explicit ApiMethodMetrics(
+            const std::string& method,
+            MetricsRegistry& registry = GetMetricsRegistry());
+
+    Counter& ResponseStatus(int status);
+
+    std::string method;
+    MetricsRegistry& registry;
+
+    Counter& requests;
+    Counter& errors;
+    Counter& retries;
+    Histogram& latency;
+    Histogram& response_bytes;
+    Histogram& parse_time;
+    Counter& status_ok;
+};
+
+
+//  Counts a request and records its latency on destruction; a request
+//  left by an exception is counted as an error.
+class ScopedApiRequest {
+public:
+    explicit ScopedApiRequest(ApiMethodMetrics& metrics);
+    ~ScopedApiRequest();
+
+private:
+    ApiMethodMetrics& metrics_;
+    int64_t start_;
+    int exceptions_;
+};
+
+
+//  Serves GET /metrics with the registry in Prometheus text format.
+//  Port 0 binds an ephemeral port.
+class MetricsServer {
+public:
+    explicit MetricsServer(
+            uint16_t port,
+            MetricsRegistry& registry = GetMetricsRegistry());
+    ~MetricsServer();
+
+    void Start();
+    void Stop();
+    uint16_t GetPort() const;
+
+private:
+    uint16_t port_;
+    MetricsRegistry& registry_;
+    std::unique_ptr<Poco::Net::ServerSocket> socket_;
+    std::unique_ptr<Poco::Net::HTTPServer> server_;
+};
+
+
+int64_t NowMicroseconds();
+
+
+#endif //TELEGRAM_METRICS_H
@@ -0,0 +1,124 @@
+#include "request_path.h"
+
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
+
+
+const char*
+ApiMethodName(
+        ApiMethod method
+) {
+    static const char* const kNames[] = {
+            "getMe",
+            "getUpdates",
+            "sendMessage",
+            "sendSticker",
+            "sendDocument"
+    };
+
+    return kNames[static_cast<size_t>(method)];
+}
+
+
+RequestPathTable::
+RequestPathTable(
+        const std::string& server_path,
+        const std::string& token
+) {
+    std::string prefix = server_path;
+    if (prefix.empty() || prefix.back() != '/') {
+        prefix += '/';
+    }
+    prefix += "bot" + token + "/";
+
+    for (size_t i = 0; i < paths_.size(); ++i) {
+        paths_[i] = prefix + ApiMethodName(static_cast<ApiMethod>(i));
+    }
+}
+
+
+std::string
+EncodeAllowedUpdates(
+        const std::vector<std::string>& update_types
+) {
+    //  Update types are lowercase identifiers, only the JSON
+    //  punctuation around them needs escaping
+    std::string encoded = "%5B";
+    for (size_t i = 0; i < update_types.size(); ++i) {
+        if (i > 0) {
+            encoded += "%2C";
+        }
+        encoded += "%22" + update_types[i] + "%22";
+    }
+
+    return encoded + "%5D";
+}
+
+
+std::string_view
+RequestTargetBuffer::
+Build(
+        std::string_view path,
+        const GetUpdatesQuery& query
+) {
+    size_ = 0;
+    separator_ = '?';
+    Append(path);
+
+    if (query.offset) {
+        AppendParam("offset", *query.offset);
+    }
+
+    if (query.timeout) {
+        AppendParam("timeout", *query.timeout);
+    }
+
+    if (query.limit) {
+        AppendParam("limit", *query.limit);
+    }
+
+    if (!query.allowed_updates.empty()) {
+        AppendParam("allowed_updates", query.allowed_updates);
+    }
+
+    return {data_.data(), size_};
+}
+
+void
+RequestTargetBuffer::
+Append(
+        std::string_view value
+) {
+    if (size_ + value.size() > data_.size()) {
+        throw std::length_error("Request target is longer than "
+                                + std::to_string(data_.size()) + " bytes");
+    }
+
+    std::memcpy(data_.data() + size_, value.data(), value.size());
+    size_ += value.size();
+}
+
+void
+RequestTargetBuffer::
+AppendParam(
+        std::string_view name,
+        int64_t value
+) {
+    char digits[24];
+    auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+    AppendParam(name, std::string_view(digits, end - digits));
+}
+
+void
+RequestTargetBuffer::
+AppendParam(
+        std::string_view name,
+        std::string_view value
+) {
+    Append(std::string_view(&separator_, 1));
+    Append(name);
+    Append("=");
+    Append(value);
+    separator_ = '&';
+}
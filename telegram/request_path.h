@@ -0,0 +1,71 @@
+#ifndef TELEGRAM_REQUEST_PATH_H
+#define TELEGRAM_REQUEST_PATH_H
+
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+enum class ApiMethod {
+    GetMe,
+    GetUpdates,
+    SendMessage,
+    SendSticker,
+    SendDocument,
+    Count
+};
+
+const char* ApiMethodName(ApiMethod method);
+
+
+//  Request paths of all Bot API methods, "<server path>bot<token>/<method>",
+//  built once so that requests neither concatenate nor parse URIs.
+class RequestPathTable {
+public:
+    RequestPathTable(const std::string& server_path, const std::string& token);
+
+    const std::string& Path(ApiMethod method) const {
+        return paths_[static_cast<size_t>(method)];
+    }
+
+private:
+    std::array<std::string, static_cast<size_t>(ApiMethod::Count)> paths_;
+};
+
+
+struct GetUpdatesQuery {
+    std::optional<int32_t> offset;
+    std::optional<int32_t> timeout;
+    std::optional<int32_t> limit;
+    //  Already encoded with EncodeAllowedUpdates(), omitted if empty
+    std::string_view allowed_updates;
+};
+
+//  Percent-encoded JSON array of update types, e.g. ["message"].
+//  Meant to be built once, when the set of handled updates is known.
+std::string EncodeAllowedUpdates(const std::vector<std::string>& update_types);
+
+
+//  Builds "path?query" request targets in a fixed buffer, so that
+//  building one never allocates. The returned view is valid until the
+//  next Build(). Throws std::length_error if the target does not fit.
+class RequestTargetBuffer {
+public:
+    std::string_view Build(std::string_view path, const GetUpdatesQuery& query);
+
+private:
+    void Append(std::string_view value);
+    void AppendParam(std::string_view name, int64_t value);
+    void AppendParam(std::string_view name, std::string_view value);
+
+    std::array<char, 1024> data_;
+    size_t size_ = 0;
+    char separator_ = '?';
+};
+
+
+#endif //TELEGRAM_REQUEST_PATH_H
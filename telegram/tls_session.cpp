@@ -0,0 +1,243 @@
+#include "tls_session.h"
+
+#include <openssl/err.h>
+#include <openssl/x509v3.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+
+namespace {
+
+std::string
+LastTlsError() {
+    std::string errors;
+    while (auto code = ERR_get_error()) {
+        char buffer[256];
+        ERR_error_string_n(code, buffer, sizeof(buffer));
+        if (!errors.empty()) {
+            errors += "; ";
+        }
+        errors += buffer;
+    }
+
+    return errors;
+}
+
+//  Called when the server issues a session. Under TLS 1.3 that happens
+//  after the handshake, in a NewSessionTicket message read with the
+//  first response, so the session cannot be taken at handshake time.
+int
+OnNewSession(
+        SSL* ssl,
+        SSL_SESSION* session
+) {
+    auto context = static_cast<TlsContext*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+    context->SetLastSession(session);
+
+    //  SetLastSession() took its own reference
+    return 0;
+}
+
+}  // namespace
+
+
+TlsContext::
+TlsContext(
+        bool verify_peer
+) {
+    context_ = SSL_CTX_new(TLS_client_method());
+    if (!context_) {
+        throw std::runtime_error("Failed to create TLS context: " + LastTlsError());
+    }
+
+    SSL_CTX_set_min_proto_version(context_, TLS1_2_VERSION);
+    if (verify_peer) {
+        SSL_CTX_set_default_verify_paths(context_);
+        SSL_CTX_set_verify(context_, SSL_VERIFY_PEER, nullptr);
+    }
+    SSL_CTX_set_session_cache_mode(context_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_set_app_data(context_, this);
+    SSL_CTX_sess_set_new_cb(context_, OnNewSession);
+}
+
+TlsContext::
+~TlsContext() {
+    if (last_session_) {
+        SSL_SESSION_free(last_session_);
+    }
+    SSL_CTX_free(context_);
+}
+
+void
+TlsContext::
+SetLastSession(
+        SSL_SESSION* session
+) {
+    if (!session || session == last_session_) {
+        return;
+    }
+
+    SSL_SESSION_up_ref(session);
+    if (last_session_) {
+        SSL_SESSION_free(last_session_);
+    }
+    last_session_ = session;
+}
+
+
+TlsSession::
+TlsSession(
+        TlsContext& context,
+        const std::string& host
+):
+        context_{context}
+{
+    ssl_ = SSL_new(context_.get());
+    in_ = BIO_new(BIO_s_mem());
+    out_ = BIO_new(BIO_s_mem());
+    if (!ssl_ || !in_ || !out_) {
+        BIO_free(in_);
+        BIO_free(out_);
+        SSL_free(ssl_);
+        throw std::runtime_error("Failed to create TLS session: " + LastTlsError());
+    }
+
+    //  An empty memory BIO means "try again later", not EOF
+    BIO_set_mem_eof_return(in_, -1);
+    SSL_set_bio(ssl_, in_, out_);
+    SSL_set_connect_state(ssl_);
+
+    SSL_set_tlsext_host_name(ssl_, host.c_str());
+    SSL_set1_host(ssl_, host.c_str());
+    if (auto session = context_.LastSession()) {
+        SSL_set_session(ssl_, session);
+    }
+}
+
+TlsSession::
+~TlsSession() {
+    //  Connections end without a close_notify from us, which OpenSSL takes
+    //  for a broken session and makes the last session non-resumable.
+    //  Only a TLS error is a reason for that.
+    if (handshake_done_ && !failed_) {
+        SSL_set_shutdown(ssl_, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    }
+
+    //  Frees both BIOs
+    SSL_free(ssl_);
+}
+
+void
+TlsSession::
+PutCiphertext(
+        const char* data,
+        size_t size
+) {
+    while (size > 0) {
+        int written = BIO_write(in_, data, static_cast<int>(size));
+        if (written <= 0) {
+            throw std::runtime_error("Failed to buffer TLS data");
+        }
+        data += written;
+        size -= written;
+    }
+}
+
+void
+TlsSession::
+TakeCiphertext(
+        std::string& out
+) {
+    while (auto pending = BIO_ctrl_pending(out_)) {
+        auto offset = out.size();
+        out.resize(offset + pending);
+        int read = BIO_read(out_, out.data() + offset, static_cast<int>(pending));
+        out.resize(offset + std::max(read, 0));
+        if (read <= 0) {
+            break;
+        }
+    }
+}
+
+bool
+TlsSession::
+Handshake() {
+    if (handshake_done_) {
+        return true;
+    }
+
+    int result = SSL_do_handshake(ssl_);
+    if (result == 1) {
+        handshake_done_ = true;
+        return true;
+    }
+
+    auto error = SSL_get_error(ssl_, result);
+    if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE) {
+        return false;
+    }
+
+    Fail("TLS handshake failed", error);
+}
+
+bool
+TlsSession::
+Resumed() const {
+    return SSL_session_reused(ssl_) == 1;
+}
+
+void
+TlsSession::
+Write(
+        std::string_view plaintext
+) {
+    while (!plaintext.empty()) {
+        int written = SSL_write(ssl_, plaintext.data(), static_cast<int>(plaintext.size()));
+        if (written <= 0) {
+            Fail("TLS write failed", SSL_get_error(ssl_, written));
+        }
+        plaintext.remove_prefix(written);
+    }
+}
+
+bool
+TlsSession::
+Read(
+        std::string& out
+) {
+    char buffer[16 * 1024];
+    while (true) {
+        int read = SSL_read(ssl_, buffer, sizeof(buffer));
+        if (read > 0) {
+            out.append(buffer, read);
+            continue;
+        }
+
+        auto error = SSL_get_error(ssl_, read);
+        if (error == SSL_ERROR_WANT_READ) {
+            return true;
+        }
+        if (error == SSL_ERROR_ZERO_RETURN) {
+            return false;
+        }
+
+        Fail("TLS read failed", error);
+    }
+}
+
+void
+TlsSession::
+Fail(
+        const char* what,
+        int result
+) {
+    failed_ = true;
+    auto errors = LastTlsError();
+    if (SSL_get_verify_result(ssl_) != X509_V_OK) {
+        errors += (errors.empty() ? "" : "; ") +
+                  std::string(X509_verify_cert_error_string(SSL_get_verify_result(ssl_)));
+    }
+
+    throw std::runtime_error(std::string(what) + " (" + std::to_string(result) + "): " + errors);
+}
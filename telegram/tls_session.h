@@ -0,0 +1,69 @@
+#ifndef TELEGRAM_TLS_SESSION_H
+#define TELEGRAM_TLS_SESSION_H
+
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <openssl/ssl.h>
+
+
+//  Client TLS context of the event loop transports. Keeps the last
+//  session the server issued, so that new connections resume it.
+class TlsContext {
+public:
+    explicit TlsContext(bool verify_peer);
+    ~TlsContext();
+
+    TlsContext(const TlsContext&) = delete;
+    TlsContext& operator=(const TlsContext&) = delete;
+
+    SSL_CTX* get() const { return context_; }
+
+    SSL_SESSION* LastSession() const { return last_session_; }
+    void SetLastSession(SSL_SESSION* session);
+
+private:
+    SSL_CTX* context_ = nullptr;
+    SSL_SESSION* last_session_ = nullptr;
+};
+
+
+//  Client side of one TLS connection over memory BIOs. The event loop
+//  moves ciphertext between the socket and this object, so the same code
+//  serves every transport backend. Throws std::runtime_error on TLS errors.
+class TlsSession {
+public:
+    TlsSession(TlsContext& context, const std::string& host);
+    ~TlsSession();
+
+    TlsSession(const TlsSession&) = delete;
+    TlsSession& operator=(const TlsSession&) = delete;
+
+    //  Ciphertext read from the socket
+    void PutCiphertext(const char* data, size_t size);
+    //  Appends ciphertext to be written to the socket
+    void TakeCiphertext(std::string& out);
+
+    //  Advances the handshake; true once it is complete
+    bool Handshake();
+    bool Resumed() const;
+
+    void Write(std::string_view plaintext);
+    //  Appends decrypted data; false once the server has closed the session
+    bool Read(std::string& out);
+
+private:
+    [[noreturn]] void Fail(const char* what, int result);
+
+    TlsContext& context_;
+    SSL* ssl_ = nullptr;
+    BIO* in_ = nullptr;     //  socket -> SSL
+    BIO* out_ = nullptr;    //  SSL -> socket
+    bool handshake_done_ = false;
+    bool failed_ = false;
+};
+
+
+#endif //TELEGRAM_TLS_SESSION_H
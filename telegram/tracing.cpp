@@ -0,0 +1,267 @@
+#include "tracing.h"
+#include "metrics.h"
+
+#include <unistd.h>
+
+#include <stdexcept>
+
+
+namespace {
+
+thread_local int64_t current_trace_id = 0;
+
+uint32_t
+ThreadId() {
+    static std::atomic<uint32_t> next{1};
+    thread_local uint32_t id = next.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+size_t
+RoundUpToPowerOfTwo(
+        size_t value
+) {
+    size_t result = 2;
+    while (result < value) {
+        result <<= 1;
+    }
+
+    return result;
+}
+
+}  // namespace
+
+
+//
+//      Tracer
+//
+
+Tracer::
+Tracer(
+        size_t capacity
+):
+        slots_{new Slot[RoundUpToPowerOfTwo(capacity)]},
+        mask_{RoundUpToPowerOfTwo(capacity) - 1}
+{
+    for (size_t i = 0; i <= mask_; ++i) {
+        slots_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+Tracer::
+~Tracer() {
+    Stop();
+}
+
+void
+Tracer::
+Start(
+        const std::string& path,
+        std::chrono::milliseconds flush_interval
+) {
+    Stop();
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    out_.open(path, std::ios_base::trunc);
+    if (!out_.is_open()) {
+        throw std::runtime_error("Failed to open trace file '" + path + "'");
+    }
+
+    //  JSON Array Format: the closing bracket is optional, so the file
+    //  stays loadable even if the process dies between flushes
+    out_ << "[\n";
+    first_event_ = true;
+    stop_requested_ = false;
+    enabled_.store(true, std::memory_order_relaxed);
+    flusher_ = std::thread(&Tracer::FlushLoop, this, flush_interval);
+}
+
+void
+Tracer::
+Stop() {
+    {
+        std::lock_guard<std::mutex> guard(mutex_);
+        if (!flusher_.joinable()) {
+            return;
+        }
+
+        enabled_.store(false, std::memory_order_relaxed);
+        stop_requested_ = true;
+    }
+
+    stop_cv_.notify_all();
+    flusher_.join();
+
+    std::lock_guard<std::mutex> guard(mutex_);
+    Flush();
+    out_ << "\n]\n";
+    out_.close();
+}
+
+void
+Tracer::
+Record(
+        const TraceEvent& event
+) {
+    //  Bounded MPMC queue by D. Vyukov, used with a single consumer
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    while (true) {
+        Slot& slot = slots_[pos & mask_];
+        size_t sequence = slot.sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+
+        if (diff == 0) {
+            if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                slot.event = event;
+                slot.sequence.store(pos + 1, std::memory_order_release);
+                return;
+            }
+
+        } else if (diff < 0) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+
+        } else {
+            pos = tail_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+size_t
+Tracer::
+Drain(
+        std::vector<TraceEvent>& events
+) {
+    size_t drained = 0;
+    size_t pos = head_.load(std::memory_order_relaxed);
+    while (true) {
+        Slot& slot = slots_[pos & mask_];
+        if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+            break;
+        }
+
+        events.push_back(slot.event);
+        slot.sequence.store(pos + mask_ + 1, std::memory_order_release);
+        ++pos;
+        ++drained;
+    }
+
+    head_.store(pos, std::memory_order_relaxed);
+    return drained;
+}
+
+void
+Tracer::
+FlushLoop(
+        std::chrono::milliseconds flush_interval
+) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_requested_) {
+        stop_cv_.wait_for(lock, flush_interval, [this] { return stop_requested_; });
+        Flush();
+    }
+}
+
+void
+Tracer::
+Flush() {
+    static const auto pid = getpid();
+
+    pending_.clear();
+    Drain(pending_);
+
+    for (const auto& event : pending_) {
+        out_ << (first_event_ ? "" : ",\n")
+             << R"({"name":")" << event.name
+             << R"(","cat":"telegram","ph":"X","ts":)" << event.start
+             << R"(,"dur":)" << event.duration
+             << R"(,"pid":)" << pid
+             << R"(,"tid":)" << event.thread_id
+             << R"(,"args":{"trace_id":)" << event.trace_id;
+
+        if (event.last_trace_id != event.trace_id) {
+            out_ << R"(,"last_trace_id":)" << event.last_trace_id;
+        }
+
+        out_ << "}}";
+        first_event_ = false;
+    }
+
+    out_.flush();
+}
+
+Tracer&
+GetTracer() {
+    static Tracer tracer;
+    return tracer;
+}
+
+
+//
+//      Trace context
+//
+
+int64_t
+CurrentTraceId() {
+    return current_trace_id;
+}
+
+ScopedTraceId::
+ScopedTraceId(
+        int64_t trace_id
+):
+        previous_{current_trace_id}
+{
+    current_trace_id = trace_id;
+}
+
+ScopedTraceId::
+~ScopedTraceId() {
+    current_trace_id = previous_;
+}
+
+
+//
+//      TraceSpan
+//
+
+TraceSpan::
+TraceSpan(
+        const char* name
+):
+        name_{name},
+        enabled_{GetTracer().Enabled()}
+{
+    if (enabled_) {
+        trace_id_ = last_trace_id_ = current_trace_id;
+        start_ = NowMicroseconds();
+    }
+}
+
+TraceSpan::
+~TraceSpan() {
+    if (!enabled_) {
+        return;
+    }
+
+    Finish();
+    GetTracer().Record({name_, trace_id_, last_trace_id_, start_, end_ - start_, ThreadId()});
+}
+
+void
+TraceSpan::
+Finish() {
+    if (enabled_ && end_ == 0) {
+        end_ = NowMicroseconds();
+    }
+}
+
+void
+TraceSpan::
+SetTraceIds(
+        int64_t first,
+        int64_t last
+) {
+    trace_id_ = first;
+    last_trace_id_ = last;
+}
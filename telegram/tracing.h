@@ -0,0 +1,118 @@
+#ifndef TELEGRAM_TRACING_H
+#define TELEGRAM_TRACING_H
+
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+//  One finished span. Names must be string literals: events are copied
+//  into the ring without any allocation. A span that covers a whole
+//  getUpdates batch carries the first and the last update id of it.
+struct TraceEvent {
+    const char* name;
+    int64_t trace_id;
+    int64_t last_trace_id;
+    int64_t start;      //  microseconds, steady clock
+    int64_t duration;   //  microseconds
+    uint32_t thread_id;
+};
+
+
+//  Collects spans into a bounded lock-free ring (multi-producer, single
+//  consumer) and periodically flushes them into a Chrome trace_event JSON
+//  file, which opens in chrome://tracing or Perfetto. Spans recorded while
+//  the ring is full are dropped and counted. Disabled tracer costs one
+//  relaxed load per span.
+class Tracer {
+public:
+    explicit Tracer(size_t capacity = 1 << 16);
+    ~Tracer();
+
+    void Start(
+            const std::string& path,
+            std::chrono::milliseconds flush_interval = std::chrono::milliseconds(1000));
+    void Stop();
+    bool Enabled() const { return enabled_.load(std::memory_order_relaxed); }
+
+    void Record(const TraceEvent& event);
+
+    //  Moves recorded events out of the ring; only one thread may drain
+    size_t Drain(std::vector<TraceEvent>& events);
+    int64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        TraceEvent event;
+    };
+
+    void FlushLoop(std::chrono::milliseconds flush_interval);
+    void Flush();
+
+    std::unique_ptr<Slot[]> slots_;
+    size_t mask_;
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+    std::atomic<int64_t> dropped_{0};
+    std::atomic<bool> enabled_{false};
+
+    std::mutex mutex_;
+    std::condition_variable stop_cv_;
+    bool stop_requested_ = false;
+    std::thread flusher_;
+    std::ofstream out_;
+    bool first_event_ = true;
+    std::vector<TraceEvent> pending_;
+};
+
+
+Tracer& GetTracer();
+
+
+//  Trace id of the update being handled on this thread, 0 if none.
+//  Spans opened while it is set belong to that update.
+int64_t CurrentTraceId();
+
+class ScopedTraceId {
+public:
+    explicit ScopedTraceId(int64_t trace_id);
+    ~ScopedTraceId();
+
+private:
+    int64_t previous_;
+};
+
+
+//  Measures its own lifetime and records it on destruction. Finish() ends
+//  the measured interval earlier, e.g. before the trace ids are known.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    void Finish();
+    void SetTraceIds(int64_t first, int64_t last);
+
+private:
+    const char* name_;
+    bool enabled_;
+    int64_t trace_id_ = 0;
+    int64_t last_trace_id_ = 0;
+    int64_t start_ = 0;
+    int64_t end_ = 0;
+};
+
+
+#endif //TELEGRAM_TRACING_H
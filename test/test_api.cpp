@@ -1,17 +1,94 @@
 #include <catch.hpp>
 
+#include "../telegram/async_channel.h"
+#include "../telegram/broadcast.h"
 #include "../telegram/fake.h"
+#include "../telegram/http_parser.h"
+#include "../telegram/json_writer.h"
 #include "../telegram/bot.h"
+#include "../telegram/metrics.h"
+#include "../telegram/request_path.h"
+#include "../telegram/tracing.h"
 
+#include <Poco/AutoPtr.h>
 #include <Poco/Exception.h>
+#include <Poco/Message.h>
+#include <Poco/Net/AcceptCertificateHandler.h>
+#include <Poco/Net/Context.h>
+#include <Poco/Net/HTTPClientSession.h>
+#include <Poco/Net/HTTPRequest.h>
+#include <Poco/Net/HTTPResponse.h>
 #include <Poco/Net/NetException.h>
+#include <Poco/Net/SSLManager.h>
+#include <Poco/StreamCopier.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <new>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 
 constexpr auto kBotToken = "123";
 constexpr auto kBotFirstName = "blablabot";
 
 
+//  Fresh directory for the state files of Bot::Run, removed with them
+class StateDir {
+public:
+    StateDir() {
+        char path[] = "/tmp/test_api_XXXXXX";
+        if (!mkdtemp(path)) {
+            throw std::runtime_error("Failed to create a state directory");
+        }
+        path_ = path;
+    }
+
+    ~StateDir() {
+        std::filesystem::remove_all(path_);
+    }
+
+    const std::string& Path() const { return path_; }
+
+private:
+    std::string path_;
+};
+
+
+//  Allocations made by the current thread, for allocation-free paths
+thread_local int64_t thread_allocations = 0;
+
+void* operator new(std::size_t size) {
+    ++thread_allocations;
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+
 TEST_CASE("Checking getMe") {
 
     telegram::FakeServer fake("Single getMe");
@@ -118,3 +195,1162 @@ TEST_CASE("Handle getUpdates offset") {
 
     fake.StopAndCheckExpectations();
 }
+
+TEST_CASE("getMe with injected 429") {
+    telegram::FakeServer fake("Single getMe", 0);
+
+    telegram::FaultProfile faults;
+    faults.TooManyRequestsProbability = 1.0;
+    faults.RetryAfter = 3;
+    fake.SetFaults("getMe", faults);
+    fake.Start();
+
+    Bot bot(kBotToken, kBotFirstName, "debug", fake.GetUrl());
+    bot.InitSession();
+
+    REQUIRE_THROWS_AS(bot.GetMe(), Poco::Net::HTTPException);
+
+    fake.ClearFaults();
+    User user = bot.GetMe();
+
+    REQUIRE(fake.GetFaultStats().TooManyRequests == 1);
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Concurrent sendMessage load") {
+    telegram::FakeServer fake("Load", 0);
+
+    telegram::FakeServerParams params;
+    params.MaxThreads = 8;
+    fake.SetParams(params);
+    fake.Start();
+
+    constexpr int kClients = 4;
+    constexpr int kMessages = 25;
+
+    std::vector<std::thread> clients;
+    for (int i = 0; i < kClients; ++i) {
+        clients.emplace_back([&fake] {
+            Bot bot(kBotToken, kBotFirstName, "error", fake.GetUrl());
+            bot.InitSession();
+            for (int j = 0; j < kMessages; ++j) {
+                bot.SendMessage(104519755, "Hi!");
+            }
+        });
+    }
+
+    for (auto& client : clients) {
+        client.join();
+    }
+
+    REQUIRE(fake.GetRequestCounts()["sendMessage"] == kClients * kMessages);
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Several fakes on ephemeral ports") {
+    telegram::FakeCluster fakes("Load", {"123", "456", "789"});
+    fakes.Start();
+
+    for (size_t i = 0; i < fakes.Size(); ++i) {
+        Bot bot(fakes[i].GetToken(), kBotFirstName, "error", fakes[i].GetUrl());
+        bot.InitSession();
+        bot.SendMessage(104519755, "Hi!");
+
+        REQUIRE(fakes[i].GetRequestCounts()["sendMessage"] == 1);
+    }
+
+    REQUIRE(fakes[0].GetPort() != fakes[1].GetPort());
+    REQUIRE(fakes.GetStats().Requests["sendMessage"] == 3);
+    fakes.StopAndCheckExpectations();
+}
+
+TEST_CASE("Fake records request timings") {
+    telegram::FakeServer fake("Load", 0);
+
+    telegram::FaultProfile faults;
+    faults.Latency.Base = std::chrono::milliseconds(20);
+    fake.SetFaults("getMe", faults);
+    fake.SetRecordRequests(true);
+    fake.Start();
+
+    Bot bot(kBotToken, kBotFirstName, "error", fake.GetUrl());
+    bot.InitSession();
+    bot.GetMe();
+    bot.SendMessage(104519755, "Hi!");
+
+    auto log = fake.GetRequestLog();
+    REQUIRE(log.size() == 2);
+    REQUIRE(log[0].Endpoint == "getMe");
+    REQUIRE(log[0].Processing >= std::chrono::milliseconds(20));
+    REQUIRE(log[1].Endpoint == "sendMessage");
+    REQUIRE(log[1].BytesIn > 0);
+    REQUIRE(log[1].BytesOut > 0);
+
+    REQUIRE(fake.GetProcessingHistogram("getMe").Min() >= 20000);
+    REQUIRE(fake.DumpStatsJson().find("\"sendMessage\"") != std::string::npos);
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Bot replies to every update of a load scenario") {
+    telegram::LoadScenario scenario;
+    scenario.Batches = 3;
+    scenario.BatchSize = 5;
+
+    telegram::FakeServer fake(scenario);
+    fake.Start();
+
+    StateDir state_dir;
+    Bot bot(kBotToken, "Test Bot", "error", fake.GetUrl());
+    bot.SetStateDir(state_dir.Path());
+    bot.Run();
+
+    auto result = fake.GetLoadResult();
+    REQUIRE(result.UpdatesServed == 15);
+    REQUIRE(result.Replies == 15);
+    REQUIRE(result.ReplyLatency.Count() == 15);
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Prewarmed connections are reused after reconnect") {
+    telegram::FakeServer fake("Load", 0);
+    fake.Start();
+
+    Bot bot(kBotToken, "Test Bot", "error", fake.GetUrl());
+    bot.SetPrewarmConnections(3);
+    bot.InitSession();
+    REQUIRE(bot.GetMe().first_name == "Test Bot");
+
+    //  Every reconnect takes the next prewarmed connection
+    for (int i = 0; i < 2; ++i) {
+        bot.CloseSession();
+        bot.InitSession();
+        REQUIRE(bot.GetMe().first_name == "Test Bot");
+    }
+    REQUIRE(bot.GetMe().first_name == "Test Bot");
+
+    auto stats = fake.GetStats();
+    REQUIRE(stats.Requests["getMe"] == 4);
+    REQUIRE(stats.Connections == 3);
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("getUpdates responses are gzip-compressed on request") {
+    auto run = [](bool compression) {
+        telegram::LoadScenario scenario;
+        scenario.Batches = 3;
+        scenario.BatchSize = 20;
+
+        telegram::FakeServerParams params;
+        params.Compression = compression;
+
+        telegram::FakeServer fake(scenario);
+        fake.SetParams(params);
+        fake.Start();
+
+        StateDir state_dir;
+        Bot bot(kBotToken, "Test Bot", "error", fake.GetUrl());
+        bot.SetStateDir(state_dir.Path());
+        bot.Run();
+
+        auto result = fake.GetLoadResult();
+        REQUIRE(result.Replies == 60);
+        auto bytes_out = fake.GetStats().BytesOut["getUpdates"];
+        fake.StopAndCheckExpectations();
+        return bytes_out;
+    };
+
+    auto plain_bytes = run(false);
+    auto gzip_bytes = run(true);
+    REQUIRE(gzip_bytes > 0);
+    REQUIRE(gzip_bytes * 2 < plain_bytes);
+}
+
+TEST_CASE("Compressed error bodies are inflated into the exception") {
+    telegram::FakeServer fake("getMe error handling");
+
+    telegram::FakeServerParams params;
+    params.Compression = true;
+    fake.SetParams(params);
+    fake.Start();
+
+    Bot bot(kBotToken, kBotFirstName, "fatal", fake.GetUrl());
+    bot.InitSession();
+
+    for (int i = 0; i < 2; ++i) {
+        try {
+            bot.GetMe();
+            FAIL("getMe should fail");
+        } catch (Poco::Net::HTTPException& e) {
+            auto body = i == 0 ? std::string("body: Internal server error") : std::string("\"ok\" : false");
+            REQUIRE(e.displayText().find(body) != std::string::npos);
+        }
+    }
+
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("getUpdates asks only for handled update types") {
+    telegram::LoadScenario scenario;
+    scenario.Batches = 2;
+    scenario.BatchSize = 3;
+
+    telegram::FakeServer fake(scenario);
+    telegram::FaultProfile faults;
+    faults.ResetProbability = 0.5;
+    fake.SetFaults("getUpdates", faults);
+    //  Resets the first getUpdates and answers the second
+    fake.SetFaultSeed(8);
+    fake.SetRecordRequests(true);
+    fake.Start();
+
+    StateDir state_dir;
+    Bot bot(kBotToken, "Test Bot", "fatal", fake.GetUrl());
+    bot.SetStateDir(state_dir.Path());
+    bot.SetUpdatesLimit(50);
+    bot.SetPollTimeout(5, 20);
+    bot.SetReconnectBackoff(std::chrono::milliseconds(1), std::chrono::milliseconds(1));
+    bot.Run();
+
+    std::vector<std::string> uris;
+    for (const auto& record : fake.GetRequestLog()) {
+        if (record.Endpoint == "getUpdates") {
+            uris.push_back(record.Uri);
+        }
+    }
+
+    REQUIRE(uris.size() >= 3);
+    REQUIRE(uris[0].find("timeout=20&limit=50&allowed_updates=%5B%22message%22%5D")
+            != std::string::npos);
+    for (const auto& uri : uris) {
+        REQUIRE(uri.find("allowed_updates=%5B%22message%22%5D") != std::string::npos);
+    }
+
+    //  Every reset halves the timeout
+    REQUIRE(fake.GetFaultStats().Resets > 0);
+    REQUIRE(uris[1].find("timeout=10&") != std::string::npos);
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Verified bot info is cached between runs") {
+    StateDir state_dir;
+
+    for (int64_t expected_get_me : {1, 0}) {
+        telegram::LoadScenario scenario;
+        scenario.Batches = 1;
+        scenario.BatchSize = 3;
+
+        telegram::FakeServer fake(scenario);
+        fake.Start();
+
+        Bot bot(kBotToken, "Test Bot", "error", fake.GetUrl());
+        bot.SetStateDir(state_dir.Path());
+        bot.Run();
+
+        REQUIRE(fake.GetLoadResult().Replies == 3);
+        REQUIRE(fake.GetStats().Requests["getMe"] == expected_get_me);
+        fake.StopAndCheckExpectations();
+    }
+}
+
+TEST_CASE("Bot info mismatch stops the bot before any reply") {
+    telegram::LoadScenario scenario;
+    scenario.Batches = 1;
+    scenario.BatchSize = 3;
+
+    telegram::FakeServer fake(scenario);
+    fake.Start();
+
+    StateDir state_dir;
+    Bot bot(kBotToken, "Other Bot", "fatal", fake.GetUrl());
+    bot.SetStateDir(state_dir.Path());
+    REQUIRE_THROWS_AS(bot.Run(), Poco::LogicException);
+    REQUIRE(fake.GetLoadResult().Replies == 0);
+    fake.Stop();
+}
+
+TEST_CASE("Bot reconnects after network errors and resumes polling") {
+    telegram::LoadScenario scenario;
+    scenario.Batches = 10;
+    scenario.BatchSize = 5;
+
+    telegram::FakeServer fake(scenario);
+    telegram::FaultProfile faults;
+    faults.ResetProbability = 0.3;
+    faults.ServerErrorBurstProbability = 0.2;
+    fake.SetFaults("getUpdates", faults);
+    fake.SetFaultSeed(7);
+    fake.SetRecordRequests(true);
+    fake.Start();
+
+    auto& reconnects = GetMetricsRegistry().GetCounter(
+            "telegram_reconnects_total", {}, "");
+    auto reconnects_before = reconnects.Value();
+    auto& retries = GetMetricsRegistry().GetCounter(
+            "telegram_request_retries_total", {{"method", "getUpdates"}}, "");
+    auto retries_before = retries.Value();
+
+    StateDir state_dir;
+    Bot bot(kBotToken, "Test Bot", "error", fake.GetUrl());
+    bot.SetStateDir(state_dir.Path());
+    bot.SetReconnectBackoff(std::chrono::milliseconds(1), std::chrono::milliseconds(10));
+    bot.Run();
+
+    auto result = fake.GetLoadResult();
+    REQUIRE(result.Replies == 50);
+    REQUIRE(reconnects.Value() > reconnects_before);
+    REQUIRE(retries.Value() > retries_before);
+
+    //  Reset connections got no response at all
+    int64_t unanswered = 0;
+    for (const auto& record : fake.GetRequestLog()) {
+        unanswered += record.Status == 0;
+    }
+    REQUIRE(unanswered == fake.GetFaultStats().Resets);
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Bot stops on permanent API errors") {
+    telegram::LoadScenario scenario;
+    scenario.Batches = 1;
+
+    telegram::FakeServer fake(scenario);
+    telegram::FaultProfile faults;
+    faults.ServerErrorBurstProbability = 1;
+    faults.ServerErrorStatus = 401;
+    fake.SetFaults("getUpdates", faults);
+    fake.Start();
+
+    StateDir state_dir;
+    Bot bot(kBotToken, "Test Bot", "fatal", fake.GetUrl());
+    bot.SetStateDir(state_dir.Path());
+    bot.SetReconnectBackoff(std::chrono::milliseconds(1), std::chrono::milliseconds(1));
+    try {
+        bot.Run();
+        FAIL("Run should throw");
+    } catch (ApiException& e) {
+        REQUIRE(e.code() == 401);
+    }
+
+    REQUIRE(fake.GetRequestCounts()["getUpdates"] == 1);
+    fake.Stop();
+}
+
+TEST_CASE("Bot skips replies the API rejects and keeps polling") {
+    telegram::LoadScenario scenario;
+    scenario.Batches = 3;
+    scenario.BatchSize = 5;
+    scenario.Mix = {{"/weather", 1}, {"/sticker", 1}};
+
+    //  Every chat blocked the bot for text replies
+    telegram::FakeServer fake(scenario);
+    telegram::FaultProfile faults;
+    faults.ServerErrorBurstProbability = 1;
+    faults.ServerErrorStatus = 403;
+    fake.SetFaults("sendMessage", faults);
+    fake.Start();
+
+    StateDir state_dir;
+    Bot bot(kBotToken, "Test Bot", "fatal", fake.GetUrl());
+    bot.SetStateDir(state_dir.Path());
+    bot.Run();
+
+    auto rejected = fake.GetFaultStats().ServerErrors;
+    REQUIRE(rejected > 0);
+    REQUIRE(fake.GetLoadResult().UpdatesServed == 15);
+    REQUIRE(fake.GetLoadResult().Replies == 15 - rejected);
+    REQUIRE(fake.GetRequestCounts()["getUpdates"] == 4);
+    fake.Stop();
+}
+
+TEST_CASE("Bot waits out flood limits before polling again") {
+    telegram::LoadScenario scenario;
+    scenario.Batches = 3;
+    scenario.BatchSize = 5;
+
+    telegram::FakeServer fake(scenario);
+    telegram::FaultProfile faults;
+    faults.TooManyRequestsProbability = 0.3;
+    faults.RetryAfter = 1;
+    fake.SetFaults("getUpdates", faults);
+    fake.SetFaultSeed(3);
+    fake.Start();
+
+    StateDir state_dir;
+    Bot bot(kBotToken, "Test Bot", "fatal", fake.GetUrl());
+    bot.SetStateDir(state_dir.Path());
+    bot.SetReconnectBackoff(std::chrono::milliseconds(1), std::chrono::milliseconds(1));
+    auto start = std::chrono::steady_clock::now();
+    bot.Run();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    auto flood_limits = fake.GetFaultStats().TooManyRequests;
+    REQUIRE(flood_limits > 0);
+    REQUIRE(elapsed >= std::chrono::seconds(flood_limits));
+    REQUIRE(fake.GetLoadResult().Replies == 15);
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Metrics are exported in Prometheus format") {
+    telegram::FakeServer fake("Load", 0);
+    fake.Start();
+
+    auto& errors = GetMetricsRegistry().GetCounter(
+            "telegram_request_errors_total", {{"method", "sendMessage"}}, "");
+    auto errors_before = errors.Value();
+
+    Bot bot(kBotToken, kBotFirstName, "error", fake.GetUrl());
+    auto port = bot.StartMetricsServer(0);
+    bot.InitSession();
+    for (int i = 0; i < 3; ++i) {
+        bot.SendMessage(1000 + i, "Hi!");
+    }
+
+    Poco::Net::HTTPClientSession session("localhost", port);
+    Poco::Net::HTTPRequest request(Poco::Net::HTTPRequest::HTTP_GET, "/metrics");
+    session.sendRequest(request);
+
+    Poco::Net::HTTPResponse response;
+    std::string body;
+    Poco::StreamCopier::copyToString(session.receiveResponse(response), body);
+
+    REQUIRE(response.getStatus() == Poco::Net::HTTPResponse::HTTP_OK);
+    REQUIRE(body.find("# TYPE telegram_requests_total counter") != std::string::npos);
+    REQUIRE(body.find("telegram_requests_total{method=\"sendMessage\"}") != std::string::npos);
+    REQUIRE(body.find("telegram_responses_total{method=\"sendMessage\",status=\"200\"}")
+            != std::string::npos);
+    REQUIRE(body.find("telegram_request_duration_seconds{method=\"sendMessage\",quantile=\"0.99\"}")
+            != std::string::npos);
+    REQUIRE(errors.Value() == errors_before);
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Update spans are written as Chrome trace") {
+    telegram::LoadScenario scenario;
+    scenario.Batches = 2;
+    scenario.BatchSize = 3;
+
+    telegram::FakeServer fake(scenario);
+    fake.Start();
+
+    const std::string trace_file = "test_trace.json";
+    GetTracer().Start(trace_file, std::chrono::milliseconds(10));
+
+    StateDir state_dir;
+    Bot bot(kBotToken, "Test Bot", "error", fake.GetUrl());
+    bot.SetStateDir(state_dir.Path());
+    bot.Run();
+
+    GetTracer().Stop();
+    fake.StopAndCheckExpectations();
+
+    std::ifstream fin(trace_file);
+    std::stringstream trace;
+    trace << fin.rdbuf();
+
+    //  The first generated update has id 1
+    for (auto span : {"receive", "parse", "dispatch", "send", "check"}) {
+        REQUIRE(trace.str().find("{\"name\":\"" + std::string(span) + "\"") != std::string::npos);
+    }
+    REQUIRE(trace.str().find("\"args\":{\"trace_id\":1,\"last_trace_id\":3}") != std::string::npos);
+    REQUIRE(GetTracer().Dropped() == 0);
+}
+
+TEST_CASE("Async log channel writes from many threads and rotates") {
+    const std::string log_file = "test_async_channel.log";
+    std::remove(log_file.c_str());
+    std::remove((log_file + ".1").c_str());
+
+    AsyncChannel::Options options;
+    options.path = log_file;
+    options.rotate_size = 16 * 1024;
+    options.rotate_count = 1;
+    options.ring_capacity = 64;
+    options.overload = AsyncChannel::OverloadPolicy::Block;
+
+    Poco::AutoPtr<AsyncChannel> channel(new AsyncChannel(options));
+    channel->open();
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&channel, t] {
+            for (int i = 0; i < 500; ++i) {
+                channel->log(Poco::Message(
+                        "BotLog",
+                        "thread " + std::to_string(t) + " message " + std::to_string(i),
+                        Poco::Message::PRIO_INFORMATION));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    channel->close();
+
+    REQUIRE(channel->Dropped() == 0);
+    REQUIRE(std::ifstream(log_file + ".1").is_open());
+
+    std::ifstream fin(log_file);
+    std::string line;
+    REQUIRE(std::getline(fin, line));
+    REQUIRE(line.find(" BotLog: Information: thread ") != std::string::npos);
+}
+
+TEST_CASE("Async log channel writes errors before returning") {
+    const std::string log_file = "test_async_channel_errors.log";
+    std::remove(log_file.c_str());
+
+    AsyncChannel::Options options;
+    options.path = log_file;
+    options.flush_interval = std::chrono::seconds(60);
+
+    Poco::AutoPtr<AsyncChannel> channel(new AsyncChannel(options));
+    channel->open();
+    channel->log(Poco::Message("BotLog", "queued", Poco::Message::PRIO_INFORMATION));
+    channel->log(Poco::Message("BotLog", "fatal", Poco::Message::PRIO_FATAL));
+
+    //  Read before close(), with the flush interval far away
+    std::stringstream written;
+    written << std::ifstream(log_file).rdbuf();
+    REQUIRE(written.str().find("BotLog: Information: queued") != std::string::npos);
+    REQUIRE(written.str().find("BotLog: Fatal: fatal") != std::string::npos);
+
+    channel->close();
+    channel->log(Poco::Message("BotLog", "late", Poco::Message::PRIO_INFORMATION));
+    REQUIRE(channel->Dropped() == 1);
+    std::remove(log_file.c_str());
+}
+
+TEST_CASE("Compact JSON writer") {
+    std::string buffer = "stale";
+    JsonWriter(buffer).BeginObject()
+            .IntField("chat_id", -274574250)
+            .StringField("text", "Say \"hi\"\n\\")
+            .BoolField("disable_notification", true)
+            .Key("ids").BeginArray().Int(1).Int(2).EndArray()
+            .EndObject();
+
+    REQUIRE(buffer == R"({"chat_id":-274574250,"text":"Say \"hi\"\n\\",)"
+                      R"("disable_notification":true,"ids":[1,2]})");
+
+    auto capacity = buffer.capacity();
+    JsonWriter(buffer).BeginObject().IntField("chat_id", 1).EndObject();
+    REQUIRE(buffer == R"({"chat_id":1})");
+    REQUIRE(buffer.capacity() == capacity);
+}
+
+TEST_CASE("Send templates patch only chat_id") {
+    telegram::FakeServer fake("Load", 0);
+    fake.SetRecordRequests(true);
+    fake.Start();
+
+    Bot bot(kBotToken, kBotFirstName, "error", fake.GetUrl());
+    bot.InitSession();
+
+    auto reply = bot.MakeSendMessageTemplate("Winter Is Coming.");
+    bot.Send(reply, 1);
+    bot.Send(reply, -274574250);
+    bot.Send(bot.MakeSendStickerTemplate("CAADAgADegADECECEAACxyOkybkFAg"), 1);
+    REQUIRE_THROWS_AS(bot.Send(SendTemplate(), 1), Poco::InvalidArgumentException);
+
+    auto log = fake.GetRequestLog();
+    REQUIRE(log.size() == 3);
+    REQUIRE(log[0].Endpoint == "sendMessage");
+    std::string first_body = R"({"chat_id":1,"text":"Winter Is Coming."})";
+    REQUIRE(log[0].BytesIn == static_cast<int64_t>(first_body.size()));
+    REQUIRE(log[1].BytesIn == log[0].BytesIn + 9);
+    REQUIRE(log[2].Endpoint == "sendSticker");
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Async sends over the epoll transport") {
+    telegram::FakeServer fake("Load", 0);
+
+    telegram::FakeServerParams params;
+    params.MaxThreads = 8;
+    fake.SetParams(params);
+
+    telegram::FaultProfile faults;
+    faults.TooManyRequestsProbability = 0.1;
+    faults.RetryAfter = 3;
+    fake.SetFaults("sendMessage", faults);
+    fake.Start();
+
+    TelegramBotAPI api(kBotToken, kBotFirstName, "error", fake.GetUrl());
+    api.InitSession();
+    auto reply = api.MakeSendMessageTemplate("Hi!");
+
+    constexpr int kMessages = 2000;
+    std::atomic<int> ok{0};
+    std::atomic<int> limited{0};
+    std::atomic<int> other{0};
+    auto count = [&](const SendResult& result) {
+        if (result.ok && result.status == 200) {
+            ++ok;
+        } else if (result.status == 429 && result.error_code == 429 &&
+                   result.description.find("retry after 3") != std::string::npos) {
+            ++limited;
+        } else {
+            ++other;
+        }
+    };
+
+    api.SetTransport(TransportBackend::Epoll, 8);
+    for (int i = 0; i < kMessages; ++i) {
+        api.SendAsync(reply, 1000 + i, count);
+    }
+    api.FlushSends();
+
+    REQUIRE(other == 0);
+    REQUIRE(ok + limited == kMessages);
+    REQUIRE(limited > 0);
+    REQUIRE(fake.GetRequestCounts()["sendMessage"] == kMessages);
+
+    //  The default backend reports the same way, inline
+    api.SetTransport(TransportBackend::Poco);
+    ok = 0;
+    limited = 0;
+    for (int i = 0; i < 20; ++i) {
+        api.SendAsync(reply, 1000 + i, count);
+    }
+    REQUIRE(ok + limited == 20);
+    REQUIRE(other == 0);
+
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("Pipelined sends survive servers closing connections") {
+    telegram::FakeServer fake("Load", 0);
+
+    //  Every 20th response closes its connection with requests behind it
+    telegram::FakeServerParams params;
+    params.MaxKeepAliveRequests = 20;
+    fake.SetParams(params);
+    fake.Start();
+
+    auto& retries = GetMetricsRegistry().GetCounter(
+            "telegram_request_retries_total", {{"method", "sendMessage"}}, "");
+    auto retries_before = retries.Value();
+
+    TelegramBotAPI api(kBotToken, kBotFirstName, "error", fake.GetUrl());
+    auto reply = api.MakeSendMessageTemplate("Hi!");
+    api.SetTransport(TransportBackend::Epoll, 2, 8);
+
+    constexpr int kMessages = 1000;
+    std::atomic<int> ok{0};
+    for (int i = 0; i < kMessages; ++i) {
+        api.SendAsync(reply, 1000 + i, [&ok](const SendResult& result) {
+            ok += result.ok;
+        });
+    }
+    api.FlushSends();
+
+    //  Each send is delivered exactly once; the ones pipelined behind a
+    //  close are sent again
+    REQUIRE(ok == kMessages);
+    REQUIRE(fake.GetRequestCounts()["sendMessage"] == kMessages);
+    REQUIRE(retries.Value() > retries_before);
+    fake.StopAndCheckExpectations();
+}
+
+//  HTTPS endpoint for transport tests. Serves one request per connection
+//  with a self-signed certificate and counts resumed handshakes.
+class LocalTlsServer {
+public:
+    LocalTlsServer() {
+        context_ = SSL_CTX_new(TLS_server_method());
+
+        EVP_PKEY* key = nullptr;
+        auto key_context = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        EVP_PKEY_keygen_init(key_context);
+        EVP_PKEY_CTX_set_ec_paramgen_curve_nid(key_context, NID_X9_62_prime256v1);
+        EVP_PKEY_keygen(key_context, &key);
+        EVP_PKEY_CTX_free(key_context);
+
+        X509* certificate = X509_new();
+        ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+        X509_gmtime_adj(X509_getm_notBefore(certificate), 0);
+        X509_gmtime_adj(X509_getm_notAfter(certificate), 3600);
+        X509_set_pubkey(certificate, key);
+        auto name = X509_get_subject_name(certificate);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                                   reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+        X509_set_issuer_name(certificate, name);
+        X509_sign(certificate, key, EVP_sha256());
+
+        SSL_CTX_use_certificate(context_, certificate);
+        SSL_CTX_use_PrivateKey(context_, key);
+        X509_free(certificate);
+        EVP_PKEY_free(key);
+
+        listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t size = sizeof(address);
+        bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), size);
+        listen(listen_fd_, 16);
+        getsockname(listen_fd_, reinterpret_cast<sockaddr*>(&address), &size);
+        port_ = ntohs(address.sin_port);
+
+        thread_ = std::thread([this] {
+            int fd;
+            while ((fd = accept(listen_fd_, nullptr, nullptr)) >= 0) {
+                Serve(fd);
+            }
+        });
+    }
+
+    ~LocalTlsServer() {
+        //  Wakes up the blocked accept()
+        shutdown(listen_fd_, SHUT_RDWR);
+        thread_.join();
+        close(listen_fd_);
+        SSL_CTX_free(context_);
+    }
+
+    std::string GetUrl() const {
+        return "https://localhost:" + std::to_string(port_) + "/";
+    }
+
+    int Handshakes() const { return handshakes_; }
+    int Resumed() const { return resumed_; }
+
+private:
+    void Serve(int fd) {
+        SSL* ssl = SSL_new(context_);
+        SSL_set_fd(ssl, fd);
+        if (SSL_accept(ssl) == 1) {
+            ++handshakes_;
+            resumed_ += SSL_session_reused(ssl);
+
+            //  Headers and a Content-Length body
+            std::string request;
+            char buffer[4096];
+            size_t headers_end;
+            while ((headers_end = request.find("\r\n\r\n")) == std::string::npos) {
+                int read = SSL_read(ssl, buffer, sizeof(buffer));
+                if (read <= 0) {
+                    break;
+                }
+                request.append(buffer, read);
+            }
+
+            auto length_at = request.find("Content-Length: ");
+            size_t length = length_at == std::string::npos ? 0 : std::stoul(request.substr(length_at + 16));
+            while (headers_end != std::string::npos && request.size() < headers_end + 4 + length) {
+                int read = SSL_read(ssl, buffer, sizeof(buffer));
+                if (read <= 0) {
+                    break;
+                }
+                request.append(buffer, read);
+            }
+
+            std::string body = R"({"ok":true,"result":{}})";
+            std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+                                   "Connection: close\r\nContent-Length: " +
+                                   std::to_string(body.size()) + "\r\n\r\n" + body;
+            SSL_write(ssl, response.data(), response.size());
+            SSL_shutdown(ssl);
+        }
+
+        SSL_free(ssl);
+        close(fd);
+    }
+
+    SSL_CTX* context_ = nullptr;
+    int listen_fd_ = -1;
+    uint16_t port_ = 0;
+    std::thread thread_;
+    std::atomic<int> handshakes_{0};
+    std::atomic<int> resumed_{0};
+};
+
+TEST_CASE("HTTPS connections of the epoll transport resume TLS sessions") {
+    LocalTlsServer server;
+
+    //  One connection, and the server closes it after every response
+    TransportOptions options;
+    options.server_url = server.GetUrl();
+    options.connections = 1;
+    options.verify_peer = false;
+    auto transport = MakeEpollTransport(options);
+
+    int ok = 0;
+    for (int i = 0; i < 3; ++i) {
+        TransportRequest request;
+        request.target = "/bot123/sendMessage";
+        request.body = R"({"chat_id":1,"text":"Hi!"})";
+        transport->Submit(std::move(request), [&ok](TransportResponse& response) {
+            ok += response.status == 200 && response.body == R"({"ok":true,"result":{}})";
+        });
+        transport->Flush();
+    }
+
+    //  Under TLS 1.3 the session arrives after the handshake
+    REQUIRE(ok == 3);
+    REQUIRE(server.Handshakes() == 3);
+    REQUIRE(server.Resumed() == 2);
+}
+
+TEST_CASE("Response parser ignores Retry-After values other than seconds") {
+    std::vector<std::pair<std::string, int32_t>> cases = {
+        {"3", 3},
+        {"Wed, 21 Oct 2026 07:28:00 GMT", 0},
+        {"-1", 0}
+    };
+    for (const auto& [value, expected] : cases) {
+        std::string response = "HTTP/1.1 429 Too Many Requests\r\nRetry-After: " + value +
+                               "\r\nContent-Length: 2\r\n\r\n{}";
+        HttpResponseParser parser;
+        REQUIRE(parser.Feed(response.data(), response.size()) == response.size());
+        REQUIRE(parser.Done());
+        REQUIRE(parser.Status() == 429);
+        REQUIRE(parser.RetryAfter() == expected);
+    }
+}
+
+TEST_CASE("Broadcast classifies failures and resumes from its checkpoint") {
+    telegram::FakeServer fake("Broadcast", 0);
+    fake.Start();
+
+    BroadcastOptions options;
+    options.chats_path = "test_broadcast_chats.txt";
+    options.checkpoint_path = "test_broadcast_chats.txt.checkpoint";
+    options.messages_per_second = 2000;
+    options.connections = 4;
+    std::remove(options.checkpoint_path.c_str());
+    {
+        std::ofstream chats(options.chats_path);
+        for (int64_t chat_id = 100; chat_id < 200; ++chat_id) {
+            chats << chat_id << "\n";
+        }
+    }
+
+    TelegramBotAPI api(kBotToken, kBotFirstName, "error", fake.GetUrl());
+    auto message = api.MakeSendMessageTemplate("Winter Is Coming.");
+
+    auto report = Broadcast(api, options).Run(message);
+    REQUIRE(report.total == 100);
+    REQUIRE(report.sent == 70);
+    REQUIRE(report.blocked == 10);
+    REQUIRE(report.deleted == 10);
+    REQUIRE(report.migrated == 10);
+    REQUIRE(report.failed == 0);
+    REQUIRE(report.migrations.size() == 10);
+    auto migration = std::find(report.migrations.begin(), report.migrations.end(),
+                               std::make_pair(int64_t{103}, int64_t{-1000000000103}));
+    REQUIRE(migration != report.migrations.end());
+    REQUIRE(fake.GetRequestCounts()["sendMessage"] == 110);
+
+    //  A crash while writing leaves a cut line, which is dropped
+    {
+        std::ofstream journal(options.checkpoint_path, std::ios::app);
+        journal << "4";
+    }
+
+    //  Everything is done, so nothing is sent again
+    auto resumed = Broadcast(api, options).Run(message);
+    REQUIRE(resumed.resumed == 100);
+    REQUIRE(resumed.sent == 0);
+    REQUIRE(resumed.migrations.size() == 10);
+    REQUIRE(fake.GetRequestCounts()["sendMessage"] == 110);
+
+    {
+        std::ofstream chats(options.chats_path, std::ios::app);
+        chats << 200 << "\n";
+    }
+    REQUIRE_THROWS_AS(Broadcast(api, options).Run(message), Poco::DataFormatException);
+
+    fake.StopAndCheckExpectations();
+    std::remove(options.chats_path.c_str());
+    std::remove(options.checkpoint_path.c_str());
+}
+
+TEST_CASE("Broadcast does not resend messages that may have been delivered") {
+    telegram::FakeServer fake("Broadcast", 0);
+
+    //  The server reads the request and resets the connection
+    telegram::FaultProfile faults;
+    faults.ResetProbability = 0.1;
+    fake.SetFaults("sendMessage", faults);
+    fake.SetFaultSeed(5);
+    fake.Start();
+
+    BroadcastOptions options;
+    options.chats_path = "test_broadcast_resets.txt";
+    options.checkpoint_path = "test_broadcast_resets.txt.checkpoint";
+    options.messages_per_second = 2000;
+    options.connections = 4;
+    std::remove(options.checkpoint_path.c_str());
+    {
+        std::ofstream chats(options.chats_path);
+        for (int64_t chat_id = 100; chat_id < 200; ++chat_id) {
+            chats << chat_id << "\n";
+        }
+    }
+
+    TelegramBotAPI api(kBotToken, kBotFirstName, "fatal", fake.GetUrl());
+    auto report = Broadcast(api, options).Run(api.MakeSendMessageTemplate("Winter Is Coming."));
+
+    auto resets = fake.GetFaultStats().Resets;
+    REQUIRE(resets > 0);
+    REQUIRE(report.unconfirmed == resets);
+    REQUIRE(report.failed == resets);
+    REQUIRE(report.retries == 0);
+
+    fake.StopAndCheckExpectations();
+    std::remove(options.chats_path.c_str());
+    std::remove(options.checkpoint_path.c_str());
+}
+
+#ifdef TELEGRAM_IO_URING
+TEST_CASE("Async sends over the io_uring transport") {
+    telegram::FakeServer fake("Load", 0);
+    fake.Start();
+
+    TelegramBotAPI api(kBotToken, kBotFirstName, "error", fake.GetUrl());
+    auto reply = api.MakeSendMessageTemplate("Hi!");
+    api.SetTransport(TransportBackend::IoUring, 4);
+
+    constexpr int kMessages = 2000;
+    std::atomic<int> ok{0};
+    for (int i = 0; i < kMessages; ++i) {
+        api.SendAsync(reply, 1000 + i, [&ok](const SendResult& result) {
+            ok += result.ok;
+        });
+    }
+    api.FlushSends();
+
+    REQUIRE(ok == kMessages);
+    REQUIRE(fake.GetRequestCounts()["sendMessage"] == kMessages);
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("io_uring transport survives servers resetting pipelined connections") {
+    telegram::FakeServer fake("Load", 0);
+
+    //  Every 5th response closes its connection. Requests pipelined behind
+    //  it may still be unread, so the server resets the connection while
+    //  sends are in flight, which must not raise SIGPIPE.
+    telegram::FakeServerParams params;
+    params.MaxKeepAliveRequests = 5;
+    fake.SetParams(params);
+    fake.Start();
+
+    TelegramBotAPI api(kBotToken, kBotFirstName, "error", fake.GetUrl());
+    auto reply = api.MakeSendMessageTemplate("Hi!");
+    api.SetTransport(TransportBackend::IoUring, 2, 8);
+
+    constexpr int kMessages = 1000;
+    std::atomic<int> ok{0};
+    std::atomic<int> failed{0};
+    for (int i = 0; i < kMessages; ++i) {
+        api.SendAsync(reply, 1000 + i, [&ok, &failed](const SendResult& result) {
+            ++(result.ok ? ok : failed);
+        });
+    }
+    api.FlushSends();
+
+    //  A reset may lose responses, never deliver a send twice
+    REQUIRE(ok + failed == kMessages);
+    REQUIRE(ok > 0);
+    REQUIRE(fake.GetRequestCounts()["sendMessage"] >= ok);
+    REQUIRE(fake.GetRequestCounts()["sendMessage"] <= kMessages);
+    fake.StopAndCheckExpectations();
+}
+#else
+TEST_CASE("io_uring transport is reported as not built") {
+    TelegramBotAPI api(kBotToken, kBotFirstName, "error", "http://localhost:1/");
+    REQUIRE_THROWS_AS(api.SetTransport(TransportBackend::IoUring), Poco::NotImplementedException);
+}
+#endif
+
+TEST_CASE("getUpdates request targets are built without allocations") {
+    RequestPathTable paths("/", kBotToken);
+    REQUIRE(paths.Path(ApiMethod::GetMe) == "/bot123/getMe");
+    REQUIRE(paths.Path(ApiMethod::SendDocument) == "/bot123/sendDocument");
+
+    auto allowed_updates = EncodeAllowedUpdates({"message", "edited_message"});
+    RequestTargetBuffer buffer;
+    std::string target;
+    target.reserve(256);
+
+    GetUpdatesQuery query;
+    query.offset = 851793508;
+    query.timeout = 30;
+    query.limit = 100;
+    query.allowed_updates = allowed_updates;
+
+    auto allocations = thread_allocations;
+    for (int i = 0; i < 100; ++i) {
+        query.offset = 851793508 + i;
+        target.assign(buffer.Build(paths.Path(ApiMethod::GetUpdates), query));
+    }
+    REQUIRE(thread_allocations == allocations);
+
+    REQUIRE(target == "/bot123/getUpdates?offset=851793607&timeout=30&limit=100"
+                      "&allowed_updates=%5B%22message%22%2C%22edited_message%22%5D");
+
+    //  Same targets as before for the parameters the bot always sent
+    REQUIRE(buffer.Build(paths.Path(ApiMethod::GetUpdates), {851793508, 5, {}, {}}) ==
+            "/bot123/getUpdates?offset=851793508&timeout=5");
+    REQUIRE(buffer.Build(paths.Path(ApiMethod::GetUpdates), {}) == "/bot123/getUpdates");
+}
+
+TEST_CASE("Send responses fast path") {
+    REQUIRE(HasOkTruePrefix(R"({"ok":true,"result":{}})"));
+    REQUIRE(HasOkTruePrefix("{\n   \"ok\" : true,\n   \"result\" : {}}"));
+    REQUIRE_FALSE(HasOkTruePrefix(R"({"ok":false,"error_code":400})"));
+    REQUIRE_FALSE(HasOkTruePrefix(R"({"result":{},"ok":true})"));
+    REQUIRE_FALSE(HasOkTruePrefix(R"({"ok":trueish})"));
+    REQUIRE_FALSE(HasOkTruePrefix(R"({"ok":tr)"));
+
+    telegram::FakeServer fake("Load", 0);
+    fake.Start();
+
+    TelegramBotAPI api(kBotToken, kBotFirstName, "error", fake.GetUrl());
+    api.SetFastSendResponses(true);
+    api.InitSession();
+    for (int i = 0; i < 10; ++i) {
+        api.SendMessage(1000 + i, "Hi!");
+    }
+
+    fake.StopAndCheckExpectations();
+    REQUIRE(fake.GetRequestCounts()["sendMessage"] == 10);
+}
+
+TEST_CASE("Local files are uploaded concurrently with progress") {
+    telegram::FakeServer fake("Load", 0);
+
+    telegram::FakeServerParams params;
+    params.MaxThreads = 4;
+    fake.SetParams(params);
+    fake.SetRecordRequests(true);
+    fake.Start();
+
+    constexpr int kUploads = 3;
+    constexpr int64_t kFileSize = 1024 * 1024 + 17;
+
+    std::vector<std::string> paths;
+    std::vector<std::string> contents(kUploads);
+    for (int i = 0; i < kUploads; ++i) {
+        paths.push_back("test_upload_" + std::to_string(i) + ".bin");
+        for (int64_t j = 0; j < kFileSize; ++j) {
+            contents[i].push_back(static_cast<char>(j * (i + 1)));
+        }
+        std::ofstream file(paths.back(), std::ios::binary);
+        file << contents[i];
+    }
+
+    TelegramBotAPI api(kBotToken, kBotFirstName, "error", fake.GetUrl());
+
+    std::vector<int64_t> last_sent(kUploads, 0);
+    std::atomic<bool> monotonic{true};
+    std::vector<std::thread> uploads;
+    for (int i = 0; i < kUploads; ++i) {
+        uploads.emplace_back([&, i] {
+            auto progress = [&, i](int64_t sent, int64_t total) {
+                if (sent <= last_sent[i] || total != kFileSize) {
+                    monotonic = false;
+                }
+                last_sent[i] = sent;
+            };
+
+            if (i == 0) {
+                api.SendStickerFile(104519755, paths[i], progress);
+            } else {
+                api.SendDocumentFile(104519755, paths[i], progress);
+            }
+        });
+    }
+
+    for (auto& upload : uploads) {
+        upload.join();
+    }
+
+    REQUIRE(monotonic);
+    for (auto sent : last_sent) {
+        REQUIRE(sent == kFileSize);
+    }
+    REQUIRE(fake.GetRequestCounts()["sendSticker"] == 1);
+    REQUIRE(fake.GetRequestCounts()["sendDocument"] == kUploads - 1);
+    for (const auto& record : fake.GetRequestLog()) {
+        REQUIRE(record.BytesIn > kFileSize);
+    }
+
+    auto uploads_received = fake.GetUploads();
+    REQUIRE(uploads_received.size() == kUploads);
+    for (const auto& upload : uploads_received) {
+        auto i = std::find(paths.begin(), paths.end(), upload.FileName) - paths.begin();
+        REQUIRE(i < kUploads);
+        REQUIRE(upload.Endpoint == (i == 0 ? "sendSticker" : "sendDocument"));
+        REQUIRE(upload.ChatId == "104519755");
+        REQUIRE(upload.Field == (i == 0 ? "sticker" : "document"));
+        REQUIRE(upload.Content == contents[i]);
+    }
+
+    REQUIRE_THROWS_AS(api.SendDocumentFile(104519755, "test_upload_missing.bin"), Poco::FileException);
+
+    for (const auto& path : paths) {
+        std::remove(path.c_str());
+    }
+    fake.StopAndCheckExpectations();
+}
+
+TEST_CASE("HTTPS uploads run while the bot reconnects") {
+    //  The local server's certificate is self-signed
+    Poco::Net::SSLManager::instance().initializeClient(
+            nullptr,
+            new Poco::Net::AcceptCertificateHandler(false),
+            new Poco::Net::Context(Poco::Net::Context::CLIENT_USE, ""));
+
+    //  Closes every connection after one response, so uploads and sends
+    //  make new sessions from the saved TLS session all the time
+    LocalTlsServer server;
+    TelegramBotAPI api(kBotToken, kBotFirstName, "error", server.GetUrl());
+    api.SetFastSendResponses(true);
+
+    constexpr int kUploaders = 3;
+    constexpr int kUploadsEach = 5;
+    std::string path = "test_upload_tls.bin";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file << std::string(64 * 1024, 'x');
+    }
+
+    std::atomic<int> uploaded{0};
+    std::atomic<bool> uploading{true};
+    std::vector<std::thread> uploaders;
+    for (int i = 0; i < kUploaders; ++i) {
+        uploaders.emplace_back([&] {
+            try {
+                for (int j = 0; j < kUploadsEach; ++j) {
+                    api.SendDocumentFile(104519755, path);
+                    ++uploaded;
+                }
+            } catch (const Poco::Exception&) {
+                //  Counted as missing below
+            }
+        });
+    }
+
+    //  Every reconnect saves the TLS session the uploads are reading
+    std::thread waiter([&] {
+        for (auto& uploader : uploaders) {
+            uploader.join();
+        }
+        uploading = false;
+    });
+    int reconnects = 0;
+    while (uploading || reconnects == 0) {
+        api.InitSession();
+        api.SendMessage(104519755, "Hi!");
+        api.CloseSession();
+        ++reconnects;
+    }
+    waiter.join();
+
+    std::remove(path.c_str());
+    REQUIRE(uploaded == kUploaders * kUploadsEach);
+    REQUIRE(server.Handshakes() == kUploaders * kUploadsEach + reconnects);
+}